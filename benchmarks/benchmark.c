@@ -0,0 +1,300 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+// Measures the row formatting of mydumper and the statement parsing of
+// myloader over synthetic rows, without a server. Rows are escaped with an
+// unconnected MYSQL handle and the statements parsed by myloader are dropped
+// instead of being executed.
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/common.h"
+#include "../src/mydumper_row.h"
+#include "../src/myloader_statement.h"
+
+/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
+#ifndef MYSQL_TYPE_JSON
+#define MYSQL_TYPE_JSON 245
+#endif
+
+#define BENCHMARK_FIELDS 6
+
+// Defined by mydumper and myloader, needed by the shared sources
+gboolean no_delete = FALSE;
+gboolean stream = FALSE;
+int detected_server = 0;
+gboolean load_data = FALSE;
+gchar *fields_enclosed_by = NULL;
+gchar *fields_terminated_by = NULL;
+gchar *lines_starting_by = NULL;
+gchar *lines_terminated_by = NULL;
+
+static guint num_rows = 1000000;
+static guint num_threads = 1;
+static guint statement_size = 1000000;
+static guint rows_per_insert = 1000;
+
+static GOptionEntry entries[] = {
+    {"rows", 0, 0, G_OPTION_ARG_INT, &num_rows,
+     "Number of rows formatted and parsed by each thread. Default 1000000", NULL},
+    {"threads", 't', 0, G_OPTION_ARG_INT, &num_threads,
+     "Number of threads running each benchmark. Default 1", NULL},
+    {"statement-size", 's', 0, G_OPTION_ARG_INT, &statement_size,
+     "Attempted size of INSERT statement in bytes, as in mydumper. Default 1000000", NULL},
+    {"rows-per-insert", 'r', 0, G_OPTION_ARG_INT, &rows_per_insert,
+     "Rows of each INSERT after splitting, as --rows in myloader. Default 1000", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+enum benchmark_type { FORMAT_INSERT, FORMAT_LOAD_DATA, PARSE_FILE, PARSE_BUFFER, PARSE_SPLIT };
+
+struct benchmark {
+  const gchar *name;
+  enum benchmark_type type;
+  gboolean json;
+  gboolean anonymize;
+};
+
+struct benchmark_thread {
+  const struct benchmark *b;
+  const GString *dump;
+  guint64 rows;
+  guint64 bytes;
+};
+
+static MYSQL_FIELD fields[BENCHMARK_FIELDS];
+
+static void initialize_fields(gboolean json){
+  memset(fields, 0, sizeof(fields));
+  fields[0].type=MYSQL_TYPE_LONG;
+  fields[0].flags=NUM_FLAG;
+  fields[1].type=MYSQL_TYPE_LONGLONG;
+  fields[1].flags=NUM_FLAG;
+  fields[2].type=MYSQL_TYPE_NEWDECIMAL;
+  fields[2].flags=NUM_FLAG;
+  fields[3].type=MYSQL_TYPE_VAR_STRING;
+  fields[4].type=MYSQL_TYPE_DATETIME;
+  fields[5].type=json ? MYSQL_TYPE_JSON : MYSQL_TYPE_BLOB;
+}
+
+// Every row has the same shape, the values change to avoid a best case for
+// the copies. Strings include characters that need to be escaped.
+static void fill_row(guint64 n, gchar values[BENCHMARK_FIELDS][128], MYSQL_ROW row, gulong *lengths){
+  guint i;
+  g_snprintf(values[0], 128, "%" G_GUINT64_FORMAT, n);
+  g_snprintf(values[1], 128, "%" G_GUINT64_FORMAT, n * 7919);
+  g_snprintf(values[2], 128, "%" G_GUINT64_FORMAT ".%02u", n % 100000, (guint)(n % 100));
+  g_snprintf(values[3], 128, "customer \"%" G_GUINT64_FORMAT "\" O'Brien\\%u", n, (guint)(n % 13));
+  g_snprintf(values[4], 128, "2021-%02u-%02u 12:%02u:%02u", (guint)(n % 12) + 1, (guint)(n % 28) + 1, (guint)(n % 60), (guint)(n % 59));
+  g_snprintf(values[5], 128, "{\"id\": %" G_GUINT64_FORMAT ", \"tags\": [\"a\", \"b\"], \"note\": \"line\\nbreak\"}", n);
+  for (i = 0; i < BENCHMARK_FIELDS; i++){
+    row[i]=values[i];
+    lengths[i]=strlen(values[i]);
+  }
+  // One NULL every 10 rows
+  if (n % 10 == 0)
+    row[4]=NULL;
+}
+
+// Same defaults that mydumper sets for each output format
+static void set_format(gboolean ld){
+  load_data=ld;
+  g_free(fields_enclosed_by);
+  g_free(fields_terminated_by);
+  g_free(lines_starting_by);
+  g_free(lines_terminated_by);
+  fields_enclosed_by=g_strdup(ld ? "\"" : "");
+  fields_terminated_by=g_strdup(ld ? "\t" : ",");
+  lines_starting_by=g_strdup(ld ? "" : "(");
+  lines_terminated_by=g_strdup(ld ? "\n" : ")\n");
+}
+
+// Same grouping of rows in statements as write_table_data_into_file(), the
+// statements are appended to dump when it is not NULL.
+static guint64 format_rows(const struct benchmark *b, GString *dump, guint64 *bytes){
+  MYSQL *conn=mysql_init(NULL);
+  gchar values[BENCHMARK_FIELDS][128];
+  gchar *row[BENCHMARK_FIELDS];
+  gulong lengths[BENCHMARK_FIELDS];
+  GList *anonymized_function=NULL;
+  GString *escaped=g_string_sized_new(3000);
+  GString *statement=g_string_sized_new(statement_size);
+  GString *statement_row=g_string_sized_new(0);
+  guint64 n, num_rows_st=0;
+  guint i;
+  if (b->anonymize){
+    anonymized_function=g_list_append(anonymized_function, &random_int_function);
+    for (i = 1; i < BENCHMARK_FIELDS; i++)
+      anonymized_function=g_list_append(anonymized_function, &identity_function);
+  }
+  *bytes=0;
+  for (n = 1; n <= num_rows; n++){
+    fill_row(n, values, row, lengths);
+    if (!statement->len){
+      if (!load_data)
+        g_string_append(statement, "INSERT INTO `benchmark` VALUES");
+      num_rows_st=0;
+    }
+    write_row_into_string(conn, row, fields, lengths, BENCHMARK_FIELDS, anonymized_function, escaped, statement_row);
+    if (num_rows_st && !load_data)
+      g_string_append_c(statement, ',');
+    g_string_append(statement, statement_row->str);
+    g_string_set_size(statement_row, 0);
+    num_rows_st++;
+    if (statement->len + 1 > statement_size || n == num_rows){
+      if (!load_data)
+        g_string_append(statement, ";\n");
+      *bytes+=statement->len;
+      if (dump != NULL)
+        g_string_append_len(dump, statement->str, statement->len);
+      g_string_set_size(statement, 0);
+    }
+  }
+  g_list_free(anonymized_function);
+  g_string_free(escaped, TRUE);
+  g_string_free(statement, TRUE);
+  g_string_free(statement_row, TRUE);
+  mysql_close(conn);
+  return num_rows;
+}
+
+// Reads the statements as restore_data_from_file() does and drops them, or
+// drops each piece of the INSERT after splitting it as myloader --rows does
+static guint64 parse_statements(const struct benchmark *b, const GString *dump, guint64 *bytes){
+  GString *data=g_string_sized_new(statement_size + 1024);
+  GString *copy=NULL;
+  FILE *infile=NULL;
+  const gchar *statement=NULL;
+  gsize statement_len=0, offset=0;
+  guint line=0, first_line=0, last_line=0;
+  gboolean eof=FALSE;
+  guint64 statements=0;
+  struct insert_splitter is;
+  *bytes=0;
+  if (b->type == PARSE_BUFFER){
+    copy=g_string_new_len(dump->str, dump->len);
+  }else{
+    infile=fmemopen(dump->str, dump->len, "r");
+    if (infile == NULL){
+      g_critical("Cannot open the dump in memory");
+      return 0;
+    }
+  }
+  while (!eof){
+    if (!(b->type == PARSE_BUFFER ?
+          read_data_from_buffer(copy, &offset, data, &eof, &line) :
+          read_data(infile, FALSE, data, &eof, &line)))
+      break;
+    if (!g_strrstr(&data->str[data->len >= 5 ? data->len - 5 : 0], ";\n"))
+      continue;
+    *bytes+=data->len;
+    if (b->type == PARSE_SPLIT && initialize_insert_splitter(&is, data, line)){
+      while (next_insert_rows(&is, rows_per_insert, &statement, &statement_len, &first_line, &last_line))
+        statements++;
+      finish_insert_splitter(&is, data);
+    }else{
+      statements++;
+      g_string_set_size(data, 0);
+    }
+  }
+  if (infile != NULL)
+    fclose(infile);
+  if (copy != NULL)
+    g_string_free(copy, TRUE);
+  g_string_free(data, TRUE);
+  return statements > 0 ? num_rows : 0;
+}
+
+static void *benchmark_thread(struct benchmark_thread *bt){
+  if (bt->b->type == FORMAT_INSERT || bt->b->type == FORMAT_LOAD_DATA)
+    bt->rows=format_rows(bt->b, NULL, &bt->bytes);
+  else
+    bt->rows=parse_statements(bt->b, bt->dump, &bt->bytes);
+  return NULL;
+}
+
+static void run_benchmark(const struct benchmark *b, const GString *dump){
+  GThread **threads=g_new(GThread *, num_threads);
+  struct benchmark_thread *bt=g_new0(struct benchmark_thread, num_threads);
+  guint64 rows=0, bytes=0;
+  guint n;
+  initialize_fields(b->json);
+  set_format(b->type == FORMAT_LOAD_DATA);
+  gint64 start=g_get_monotonic_time();
+  for (n = 0; n < num_threads; n++){
+    bt[n].b=b;
+    bt[n].dump=dump;
+    threads[n]=g_thread_create((GThreadFunc)benchmark_thread, &bt[n], TRUE, NULL);
+  }
+  for (n = 0; n < num_threads; n++){
+    g_thread_join(threads[n]);
+    rows+=bt[n].rows;
+    bytes+=bt[n].bytes;
+  }
+  gdouble seconds=(gdouble)(g_get_monotonic_time() - start) / G_TIME_SPAN_SECOND;
+  if (seconds <= 0)
+    seconds=1e-6;
+  g_print("%-24s %12.0f rows/s %10.1f MB/s %12.0f rows/s/core %10.1f MB/s/core\n", b->name,
+          rows / seconds, bytes / seconds / 1024 / 1024,
+          rows / seconds / num_threads, bytes / seconds / 1024 / 1024 / num_threads);
+  g_free(threads);
+  g_free(bt);
+}
+
+int main(int argc, char *argv[]){
+  GError *error=NULL;
+  GOptionContext *context=g_option_context_new("benchmark of the row formatting and parsing");
+  GOptionGroup *main_group=g_option_group_new("main", "Main Options", "Main Options", NULL, NULL);
+  guint64 bytes=0;
+  guint i;
+  const struct benchmark benchmarks[] = {
+    {"format insert",           FORMAT_INSERT,    FALSE, FALSE},
+    {"format insert json",      FORMAT_INSERT,    TRUE,  FALSE},
+    {"format insert anonymized",FORMAT_INSERT,    FALSE, TRUE},
+    {"format load data",        FORMAT_LOAD_DATA, FALSE, FALSE},
+    {"parse read_data",         PARSE_FILE,       FALSE, FALSE},
+    {"parse prefetched",        PARSE_BUFFER,     FALSE, FALSE},
+    {"parse split insert",      PARSE_SPLIT,      FALSE, FALSE},
+  };
+  g_option_group_add_entries(main_group, entries);
+  g_option_context_set_main_group(context, main_group);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_print("option parsing failed: %s, try --help\n", error->message);
+    exit(EXIT_FAILURE);
+  }
+  g_option_context_free(context);
+  if (num_threads == 0)
+    num_threads=1;
+  g_thread_init(NULL);
+
+  // The parsing benchmarks read the file that the INSERT formatting writes
+  initialize_fields(FALSE);
+  set_format(FALSE);
+  GString *dump=g_string_sized_new((gsize)num_rows * 200);
+  format_rows(&benchmarks[0], dump, &bytes);
+
+  g_print("%u rows per thread, %u threads, %" G_GUINT64_FORMAT " bytes of INSERT statements per thread\n",
+          num_rows, num_threads, bytes);
+  for (i = 0; i < G_N_ELEMENTS(benchmarks); i++)
+    run_benchmark(&benchmarks[i], dump);
+
+  g_string_free(dump, TRUE);
+  mysql_library_end();
+  return 0;
+}
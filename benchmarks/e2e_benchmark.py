@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+#        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+#
+# Starts a throwaway mysqld or mariadbd, generates datasets of different
+# shapes and runs mydumper and myloader over each of them with every
+# combination of threads and compression. The results are written as JSON.
+#
+# Usage: e2e_benchmark.py --mysqld /usr/sbin/mysqld [--threads 1,4,8]
+#          [--compress off,on] [--datasets all] [--scale 1] [--report report.json]
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+DATASETS = ["tiny_tables", "int_pk", "string_pk", "no_index", "wide_blob", "partitioned"]
+
+
+def log(message):
+    sys.stderr.write("%s %s\n" % (time.strftime("%Y-%m-%d %H:%M:%S"), message))
+    sys.stderr.flush()
+
+
+def find_install_db(mysqld):
+    bindir = os.path.dirname(os.path.realpath(mysqld))
+    for path in [os.path.join(bindir, name) for name in ("mariadb-install-db", "mysql_install_db")] + \
+                [os.path.join(bindir, "..", "scripts", "mariadb-install-db"),
+                 os.path.join(bindir, "..", "scripts", "mysql_install_db")]:
+        if os.path.exists(path):
+            return path
+    return shutil.which("mariadb-install-db") or shutil.which("mysql_install_db")
+
+
+class Server:
+    """A mysqld that only listens on a socket of the work directory."""
+
+    def __init__(self, args, workdir):
+        self.args = args
+        self.datadir = os.path.join(workdir, "data")
+        self.socket = os.path.join(workdir, "mysql.sock")
+        self.process = None
+        version = subprocess.run([args.mysqld, "--version"], stdout=subprocess.PIPE,
+                                 universal_newlines=True, check=True).stdout
+        self.version = version.strip()
+        self.is_mariadb = "MariaDB" in version
+
+    def initialize(self):
+        os.makedirs(self.datadir)
+        if self.is_mariadb:
+            install_db = self.args.install_db or find_install_db(self.args.mysqld)
+            if install_db is None:
+                raise RuntimeError("mariadb-install-db not found, use --install-db")
+            basedir = os.path.dirname(os.path.dirname(os.path.realpath(self.args.mysqld)))
+            cmd = [install_db, "--no-defaults", "--datadir=" + self.datadir, "--basedir=" + basedir,
+                   "--auth-root-authentication-method=normal", "--skip-test-db"]
+        else:
+            cmd = [self.args.mysqld, "--no-defaults", "--initialize-insecure", "--datadir=" + self.datadir]
+        subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+
+    def start(self):
+        cmd = [self.args.mysqld, "--no-defaults", "--datadir=" + self.datadir, "--socket=" + self.socket,
+               "--skip-networking", "--pid-file=" + os.path.join(self.datadir, "mysqld.pid"),
+               "--log-error=" + os.path.join(self.datadir, "error.log"),
+               "--local-infile=1", "--secure-file-priv=",
+               "--innodb-buffer-pool-size=" + self.args.buffer_pool_size,
+               "--max-allowed-packet=256M"] + self.args.mysqld_args
+        if os.geteuid() == 0:
+            cmd.append("--user=root")
+        self.process = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for _ in range(600):
+            if self.process.poll() is not None:
+                raise RuntimeError("mysqld exited, see %s" % os.path.join(self.datadir, "error.log"))
+            if os.path.exists(self.socket) and self.query("SELECT 1", check=False).returncode == 0:
+                return
+            time.sleep(0.1)
+        raise RuntimeError("mysqld did not start")
+
+    def stop(self):
+        if self.process is not None and self.process.poll() is None:
+            self.process.terminate()
+            self.process.wait()
+
+    def query(self, sql, database=None, check=True):
+        cmd = [self.args.mysql, "--no-defaults", "-S", self.socket, "-u", "root", "-N", "-B"]
+        if database:
+            cmd += ["-D", database]
+        return subprocess.run(cmd, input=sql, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                              universal_newlines=True, check=check)
+
+
+def generate_datasets(server, datasets, scale):
+    """Creates a database per dataset. Rows are generated from a sequence
+    table, so the same scale always produces the same data."""
+    rows = {}
+    server.query("""
+        CREATE DATABASE bench_seq;
+        CREATE TABLE bench_seq.digits (d INT NOT NULL);
+        INSERT INTO bench_seq.digits VALUES (0),(1),(2),(3),(4),(5),(6),(7),(8),(9);
+        CREATE TABLE bench_seq.seq (n INT NOT NULL PRIMARY KEY);
+        INSERT INTO bench_seq.seq SELECT a.d + b.d*10 + c.d*100 + d.d*1000 + e.d*10000 + f.d*100000
+          FROM bench_seq.digits a, bench_seq.digits b, bench_seq.digits c,
+               bench_seq.digits d, bench_seq.digits e, bench_seq.digits f;
+        """)
+    # Up to 10 million rows from the 1 million of the sequence
+    seq = "(SELECT s.n + d.d * 1000000 AS n FROM bench_seq.seq s, bench_seq.digits d) q"
+    for name in datasets:
+        log("Generating %s" % name)
+        db = "bench_" + name
+        sql = "CREATE DATABASE %s;\nUSE %s;\n" % (db, db)
+        if name == "tiny_tables":
+            tables = int(1000 * scale)
+            for i in range(tables):
+                sql += "CREATE TABLE t%d (id INT NOT NULL PRIMARY KEY, v VARCHAR(32));\n" % i
+                sql += "INSERT INTO t%d SELECT n, MD5(n) FROM bench_seq.seq WHERE n < 10;\n" % i
+            rows[name] = tables * 10
+        elif name == "int_pk":
+            rows[name] = int(2000000 * scale)
+            sql += ("CREATE TABLE t (id BIGINT NOT NULL PRIMARY KEY, a INT, b VARCHAR(64), c DATETIME, d DECIMAL(12,2));\n"
+                    "INSERT INTO t SELECT n, n %% 1000, MD5(n), '2021-01-01' + INTERVAL n SECOND, n / 7 FROM %s WHERE n < %d;\n"
+                    % (seq, rows[name]))
+        elif name == "string_pk":
+            rows[name] = int(500000 * scale)
+            sql += ("CREATE TABLE t (id VARCHAR(64) NOT NULL PRIMARY KEY, a INT, b VARCHAR(255));\n"
+                    "INSERT INTO t SELECT SHA1(n), n, REPEAT(MD5(n), 4) FROM %s WHERE n < %d;\n" % (seq, rows[name]))
+        elif name == "no_index":
+            rows[name] = int(500000 * scale)
+            sql += ("CREATE TABLE t (a INT, b VARCHAR(64), c DOUBLE);\n"
+                    "INSERT INTO t SELECT n, MD5(n), n / 3 FROM %s WHERE n < %d;\n" % (seq, rows[name]))
+        elif name == "wide_blob":
+            rows[name] = int(10000 * scale)
+            sql += ("CREATE TABLE t (id INT NOT NULL PRIMARY KEY, b LONGBLOB);\n"
+                    "INSERT INTO t SELECT n, REPEAT(SHA2(n, 256), 1024) FROM %s WHERE n < %d;\n" % (seq, rows[name]))
+        elif name == "partitioned":
+            rows[name] = int(1000000 * scale)
+            sql += ("CREATE TABLE t (id INT NOT NULL PRIMARY KEY, a INT, b VARCHAR(64))"
+                    " PARTITION BY HASH(id) PARTITIONS 16;\n"
+                    "INSERT INTO t SELECT n, n %% 100, MD5(n) FROM %s WHERE n < %d;\n" % (seq, rows[name]))
+        server.query(sql)
+    server.query("DROP DATABASE bench_seq;")
+    return rows
+
+
+def run_tool(cmd, logfile):
+    """Runs the tool and returns the elapsed seconds, its peak RSS in KB and
+    its exit status."""
+    with open(logfile, "w") as output:
+        start = time.monotonic()
+        process = subprocess.Popen(cmd, stdout=output, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.monotonic() - start
+    process.returncode = os.waitstatus_to_exitcode(status) if hasattr(os, "waitstatus_to_exitcode") else status
+    return elapsed, usage.ru_maxrss, process.returncode
+
+
+def lock_time(trace_file):
+    """Time in seconds that mydumper kept the tables locked, taken from the
+    spans of --trace-file."""
+    try:
+        with open(trace_file) as f:
+            events = json.load(f)["traceEvents"]
+    except (OSError, ValueError, KeyError):
+        return None
+    return sum(e.get("dur", 0) for e in events
+               if e.get("ph") == "X" and e.get("name") in ("lock acquire", "locked")) / 1000000
+
+
+def directory_stats(directory):
+    files = 0
+    size = 0
+    for root, _, names in os.walk(directory):
+        for name in names:
+            files += 1
+            size += os.path.getsize(os.path.join(root, name))
+    return files, size
+
+
+def benchmark(args, server, workdir, dataset, rows, threads, compress):
+    db = "bench_" + dataset
+    name = "%s-t%d%s" % (dataset, threads, "-c" if compress else "")
+    dump_dir = os.path.join(workdir, "dump-" + name)
+    trace_file = os.path.join(workdir, "trace-" + name + ".json")
+    result = {"dataset": dataset, "threads": threads, "compress": compress, "rows": rows}
+
+    cmd = [args.mydumper, "-S", server.socket, "-u", "root", "-B", db, "-o", dump_dir,
+           "-t", str(threads), "--trace-file", trace_file] + (["-c"] if compress else []) + args.mydumper_args
+    log("mydumper %s" % name)
+    elapsed, rss, status = run_tool(cmd, os.path.join(workdir, "mydumper-" + name + ".log"))
+    files, size = directory_stats(dump_dir)
+    result["mydumper"] = {"status": status, "seconds": elapsed, "peak_rss_kb": rss,
+                          "rows_per_second": rows / elapsed if elapsed else None,
+                          "bytes": size, "mb_per_second": size / elapsed / 1024 / 1024 if elapsed else None,
+                          "files": files, "lock_seconds": lock_time(trace_file)}
+
+    # Restored into another database, the source is used by the next runs
+    cmd = [args.myloader, "-S", server.socket, "-u", "root", "-d", dump_dir, "-B", db + "_restore", "-o",
+           "-t", str(threads)] + args.myloader_args
+    log("myloader %s" % name)
+    elapsed, rss, status = run_tool(cmd, os.path.join(workdir, "myloader-" + name + ".log"))
+    result["myloader"] = {"status": status, "seconds": elapsed, "peak_rss_kb": rss,
+                          "rows_per_second": rows / elapsed if elapsed else None,
+                          "mb_per_second": size / elapsed / 1024 / 1024 if elapsed else None}
+    server.query("DROP DATABASE IF EXISTS %s_restore;" % db, check=False)
+    if not args.keep:
+        shutil.rmtree(dump_dir, ignore_errors=True)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End to end benchmark of mydumper and myloader")
+    parser.add_argument("--mysqld", required=True, help="mysqld or mariadbd binary to start")
+    parser.add_argument("--install-db", help="mariadb-install-db, needed for MariaDB when it is not found")
+    parser.add_argument("--mysql", default="mysql", help="mysql client, default mysql")
+    parser.add_argument("--mydumper", default="./mydumper", help="default ./mydumper")
+    parser.add_argument("--myloader", default="./myloader", help="default ./myloader")
+    parser.add_argument("--threads", default="1,4,8", help="comma separated thread counts, default 1,4,8")
+    parser.add_argument("--compress", default="off,on", help="off, on or both, default off,on")
+    parser.add_argument("--datasets", default="all", help="comma separated list of %s, default all" % ",".join(DATASETS))
+    parser.add_argument("--scale", type=float, default=1, help="multiplies the rows of every dataset, default 1")
+    parser.add_argument("--buffer-pool-size", default="1G", help="innodb_buffer_pool_size, default 1G")
+    parser.add_argument("--mysqld-arg", dest="mysqld_args", action="append", default=[], help="extra mysqld option")
+    parser.add_argument("--mydumper-arg", dest="mydumper_args", action="append", default=[], help="extra mydumper option")
+    parser.add_argument("--myloader-arg", dest="myloader_args", action="append", default=[], help="extra myloader option")
+    parser.add_argument("--workdir", help="directory for the server and the dumps, default a temporary one")
+    parser.add_argument("--keep", action="store_true", help="do not remove the temporary work directory nor the dumps")
+    parser.add_argument("--report", default="benchmark_report.json", help="default benchmark_report.json")
+    args = parser.parse_args()
+
+    datasets = DATASETS if args.datasets == "all" else args.datasets.split(",")
+    for dataset in datasets:
+        if dataset not in DATASETS:
+            parser.error("unknown dataset %s" % dataset)
+    threads = [int(t) for t in args.threads.split(",")]
+    compress = [c == "on" for c in args.compress.split(",")]
+
+    # only a directory created here is removed, never one given with --workdir
+    created = args.workdir is None
+    workdir = tempfile.mkdtemp(prefix="mydumper-benchmark-") if created else args.workdir
+    os.makedirs(workdir, exist_ok=True)
+    server = Server(args, workdir)
+    report = {"server": server.version, "scale": args.scale, "started": time.strftime("%Y-%m-%dT%H:%M:%S"),
+              "results": []}
+    try:
+        log("Starting %s in %s" % (server.version, workdir))
+        server.initialize()
+        server.start()
+        rows = generate_datasets(server, datasets, args.scale)
+        for dataset in datasets:
+            for t in threads:
+                for c in compress:
+                    report["results"].append(benchmark(args, server, workdir, dataset, rows[dataset], t, c))
+    finally:
+        server.stop()
+        if created and not args.keep:
+            shutil.rmtree(workdir, ignore_errors=True)
+    with open(args.report, "w") as f:
+        json.dump(report, f, indent=2)
+    log("Report written to %s" % args.report)
+    return 1 if any(r["mydumper"]["status"] or r["myloader"]["status"] for r in report["results"]) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -19,9 +19,6 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 
-#define _LARGEFILE64_SOURCE
-#define _FILE_OFFSET_BITS 64
-
 #if defined MARIADB_CLIENT_VERSION_STR && !defined MYSQL_SERVER_VERSION
 #define MYSQL_SERVER_VERSION MARIADB_CLIENT_VERSION_STR
 #endif
@@ -41,6 +38,10 @@
 #include "src/regex.h"
 #include "src/mydumper_start_dump.h"
 #include "src/mydumper_daemon_thread.h"
+#include "src/metrics.h"
+#include "src/trace.h"
+#include "src/control.h"
+#include "src/mydumper_server_health.h"
 const char DIRECTORY[] = "export";
 
 /* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
@@ -54,6 +55,7 @@ gchar *output_directory_param = NULL;
 gchar *dump_directory = NULL;
 gboolean daemon_mode = FALSE;
 gchar *disk_limits=NULL;
+extern guint health_check_interval;
 
 // For daemon mode
 gboolean shutdown_triggered = FALSE;
@@ -109,6 +111,10 @@ int main(int argc, char *argv[]) {
   load_regex_entries(main_group);
   load_start_dump_entries(main_group);
   load_daemon_entries(main_group);
+  load_metrics_entries(main_group);
+  load_trace_entries(main_group);
+  load_control_entries(main_group);
+  load_server_health_entries(main_group);
   g_option_context_set_main_group(context, main_group);
   gchar ** tmpargv=g_strdupv(argv);
   int tmpargc=argc;
@@ -160,6 +166,9 @@ int main(int argc, char *argv[]) {
   g_message("MyDumper backup version: %s", VERSION);
 
   initialize_regex();
+  initialize_metrics("mydumper");
+  initialize_trace();
+  initialize_control("mydumper", num_threads, health_check_interval > 0);
   time_t t;
   time(&t);
   localtime_r(&t, &tval);
@@ -193,6 +202,9 @@ int main(int argc, char *argv[]) {
   } else {
     start_dump();
   }
+  finish_metrics();
+  finish_trace();
+  finish_control();
 
   g_free(output_directory);
   g_strfreev(tables);
@@ -18,6 +18,10 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <glib/gstdio.h>
 #include "server_detect.h"
 extern gboolean no_delete;
@@ -59,6 +63,101 @@ char * checksum_table(MYSQL *conn, char *database, char *table, int *errn){
 }
 
 
+// Builds the query that checksums a chunk of the table on the server: the
+// number of rows and the BIT_XOR of the CRC32 of each row. CONCAT_WS skips
+// NULL values, so the NULL flags of the columns are added at the end.
+gchar *build_chunk_checksum_query(MYSQL *conn, char *database, char *table, int *errn){
+  MYSQL_RES *result = NULL;
+  MYSQL_ROW row;
+  *errn=0;
+  char *query = g_strdup_printf("SHOW COLUMNS FROM `%s`.`%s`", database, table);
+  if (mysql_query(conn, query) || !(result = mysql_store_result(conn))) {
+    g_critical("Error getting the columns of %s.%s: %s", database, table, mysql_error(conn));
+    *errn=mysql_errno(conn);
+    g_free(query);
+    return NULL;
+  }
+  g_free(query);
+  GString *columns = g_string_new("");
+  GString *nulls = g_string_new("");
+  while ((row = mysql_fetch_row(result))) {
+    if (columns->len > 0){
+      g_string_append_c(columns, ',');
+      g_string_append_c(nulls, ',');
+    }
+    g_string_append_printf(columns, "`%s`", row[0]);
+    g_string_append_printf(nulls, "ISNULL(`%s`)", row[0]);
+  }
+  mysql_free_result(result);
+  gchar *r = g_strdup_printf("SELECT COUNT(*), COALESCE(BIT_XOR(CRC32(CONCAT_WS('#',%s,CONCAT(%s)))),0) FROM `%s`.`%s`",
+                             columns->str, nulls->str, database, table);
+  g_string_free(columns, TRUE);
+  g_string_free(nulls, TRUE);
+  return r;
+}
+
+// Returns the number of rows and the checksum of the rows that match where,
+// which can be NULL or empty for the whole table
+char * checksum_chunk(MYSQL *conn, const gchar *chunk_query, const gchar *where, int *errn){
+  MYSQL_RES *result = NULL;
+  MYSQL_ROW row;
+  *errn=0;
+  char *query = g_strdup_printf("%s %s %s", chunk_query, where && *where ? "WHERE" : "", where ? where : "");
+  if (mysql_query(conn, query) || !(result = mysql_use_result(conn))) {
+    g_critical("Error dumping chunk checksum (%s): %s", query, mysql_error(conn));
+    *errn=mysql_errno(conn);
+    g_free(query);
+    return NULL;
+  }
+  g_free(query);
+
+  row = mysql_fetch_row(result);
+  if (row == NULL) {
+    g_critical("Error dumping chunk checksum: %s", mysql_error(conn));
+    *errn=mysql_errno(conn);
+    mysql_free_result(result);
+    return NULL;
+  }
+  char * r=g_strdup_printf("%s %s",row[0],row[1]);
+  mysql_free_result(result);
+  return r;
+}
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static guint64 fnv1a_update(guint64 h, const guchar *data, gsize len){
+  gsize i;
+  for (i = 0; i < len; i++){
+    h ^= data[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+// FNV-1a over the text values of a row, each one prefixed by its length so
+// that moving bytes between fields changes the result. The rows of a chunk
+// are added up, which makes the chunk checksum independent of the order in
+// which the rows are read.
+guint64 checksum_row(MYSQL_ROW row, unsigned long *lengths, guint num_fields){
+  guint64 h = FNV_OFFSET_BASIS;
+  guchar len[4];
+  guint32 l;
+  guint i;
+  for (i = 0; i < num_fields; i++){
+    // NULL is encoded as a length that no value can have
+    l = row[i] == NULL ? G_MAXUINT32 : (guint32)lengths[i];
+    len[0] = l & 0xff;
+    len[1] = (l >> 8) & 0xff;
+    len[2] = (l >> 16) & 0xff;
+    len[3] = (l >> 24) & 0xff;
+    h = fnv1a_update(h, len, sizeof(len));
+    if (row[i] != NULL)
+      h = fnv1a_update(h, (const guchar *)row[i], lengths[i]);
+  }
+  return h;
+}
+
 void load_config_file(gchar * config_file, GOptionContext *context, const gchar * group){
   GError *error = NULL;
   GKeyFile *kf = g_key_file_new ();
@@ -259,3 +358,86 @@ gboolean is_table_in_list(gchar *table_name, gchar **table_list){
       return TRUE;
   return FALSE;
 }
+
+// Returns the given column of the first row as a number, or -1 if there is
+// none. Used to sample the load of the server.
+gint64 get_server_value(MYSQL *conn, const gchar *query, guint column){
+  MYSQL_RES *res=NULL;
+  MYSQL_ROW row;
+  gint64 value=-1;
+  if (mysql_query(conn, query) || !(res = mysql_store_result(conn)))
+    return -1;
+  if ((row = mysql_fetch_row(res)) && mysql_num_fields(res) > column && row[column] != NULL)
+    value=g_ascii_strtoll(row[column], NULL, 10);
+  mysql_free_result(res);
+  return value;
+}
+
+// The highest Seconds_Behind_Master of all the channels, -1 if it is not a
+// replica or the replication is stopped
+gint64 get_replica_lag(MYSQL *conn){
+  MYSQL_RES *res=NULL;
+  MYSQL_ROW row;
+  MYSQL_FIELD *fields=NULL;
+  guint i;
+  gint64 lag=-1;
+  if (mysql_query(conn, "SHOW SLAVE STATUS") || !(res = mysql_store_result(conn)))
+    return -1;
+  fields=mysql_fetch_fields(res);
+  while ((row = mysql_fetch_row(res))) {
+    for (i = 0; i < mysql_num_fields(res); i++)
+      if (!strcasecmp("Seconds_Behind_Master", fields[i].name) && row[i] != NULL)
+        lag=MAX(lag, g_ascii_strtoll(row[i], NULL, 10));
+  }
+  mysql_free_result(res);
+  return lag;
+}
+
+// Appends str to s as a quoted JSON string
+void append_json_string(GString *s, const gchar *str){
+  const gchar *c=NULL;
+  g_string_append_c(s, '"');
+  for (c = str; *c != '\0'; c++){
+    if (*c == '"' || *c == '\\')
+      g_string_append_printf(s, "\\%c", *c);
+    else if ((guchar)*c < 0x20)
+      g_string_append_printf(s, "\\u%04x", (guchar)*c);
+    else
+      g_string_append_c(s, *c);
+  }
+  g_string_append_c(s, '"');
+}
+
+// Listens on a UNIX socket that only the owner can connect to. A socket left
+// by a previous run is replaced, but any other file at path is kept and the
+// call fails with EEXIST.
+int listen_on_unix_socket(const gchar *path){
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd=-1;
+  if (strlen(path) >= sizeof(addr.sun_path)){
+    errno=ENAMETOOLONG;
+    return -1;
+  }
+  if (lstat(path, &st) == 0){
+    if (!S_ISSOCK(st.st_mode)){
+      errno=EEXIST;
+      return -1;
+    }
+    unlink(path);
+  }
+  fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path, path);
+  // Nobody can connect before listen, so the mode is set in between
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path, 0600) != 0 || listen(fd, 8) != 0){
+    int e=errno;
+    close(fd);
+    errno=e;
+    return -1;
+  }
+  return fd;
+}
@@ -22,6 +22,11 @@
 
 
 char * checksum_table(MYSQL *conn, char *database, char *table, int *errn);
+gchar *build_chunk_checksum_query(MYSQL *conn, char *database, char *table, int *errn);
+char * checksum_chunk(MYSQL *conn, const gchar *chunk_query, const gchar *where, int *errn);
+gint64 get_server_value(MYSQL *conn, const gchar *query, guint column);
+gint64 get_replica_lag(MYSQL *conn);
+guint64 checksum_row(MYSQL_ROW row, unsigned long *lengths, guint num_fields);
 int write_file(FILE * file, char * buff, int len);
 void create_backup_dir(char *new_directory) ;
 guint strcount(gchar *text);
@@ -29,6 +34,7 @@ gboolean m_remove(gchar * directory, const gchar * filename);
 void load_config_file(gchar * config_file, GOptionContext *context, const gchar * group);
 void execute_gstring(MYSQL *conn, GString *ss);
 gchar * identity_function(gchar ** r);
+gchar * random_int_function(gchar ** r);
 gchar *replace_escaped_strings(gchar *c);
 void load_hash_from_key_file(GHashTable * set_session_hash, GHashTable *all_anonymized_function, gchar * config_file, const gchar * group_variables);
 //void load_hash_from_key_file(GHashTable * set_session_hash, gchar * config_file, const gchar * group_variables);
@@ -36,5 +42,7 @@ void refresh_set_session_from_hash(GString *ss, GHashTable * set_session_hash);
 gboolean is_table_in_list(gchar *table_name, gchar **table_list);
 GHashTable * initialize_hash_of_session_variables();
 void load_common_entries(GOptionGroup *main_group);
+void append_json_string(GString *s, const gchar *str);
+int listen_on_unix_socket(const gchar *path);
 #endif
 
@@ -132,6 +132,18 @@ void m_connect(MYSQL *conn, const gchar *app, gchar *schema){
   }
 }
 
+// Same credentials and options as m_connect, but to another server and
+// without exiting, the caller decides if it can go on without it
+gboolean m_connect_to_host(MYSQL *conn, const gchar *app, const gchar *host, guint host_port){
+  configure_connection(conn, app);
+  if (!mysql_real_connect(conn, host, username, password, NULL, host_port,
+                          NULL, 0)) {
+    g_warning("Error connection to %s: %s", host, mysql_error(conn));
+    return FALSE;
+  }
+  return TRUE;
+}
+
 void hide_password(int argc, char *argv[]){
   if (password != NULL){
     int i=1;
@@ -22,6 +22,7 @@
 
 //void configure_connection(MYSQL *conn, const char *name);
 void m_connect(MYSQL *conn, const gchar *app, gchar *schema);
+gboolean m_connect_to_host(MYSQL *conn, const gchar *app, const gchar *host, guint host_port);
 void hide_password(int argc, char *argv[]);
 void ask_password();
 void load_connection_entries(GOptionGroup *main_group);
@@ -0,0 +1,325 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <mysql.h>
+#include "common.h"
+#include "control.h"
+
+extern guint errors;
+
+#define CONTROL_CLIENT_TIMEOUT 10
+
+gboolean control_enabled = FALSE;
+gchar *control_socket = NULL;
+guint max_throughput = 0;
+
+static const gchar *control_tool = NULL;
+static GMutex *control_mutex = NULL;
+static GCond *control_cond = NULL;
+static gboolean control_paused = FALSE;
+static guint control_threads = 0;
+static guint active_threads = 0;
+static guint adaptive_threads = 0;
+static guint running_jobs = 0;
+static guint64 finished_jobs = 0;
+static guint64 control_bytes = 0;
+static gint64 control_start = 0;
+static gint64 throttle_next = 0;
+static void (*control_progress)(GString *) = NULL;
+static int control_socket_fd = -1;
+static GPrivate *control_pending = NULL;
+
+static GOptionEntry control_entries[] = {
+    {"control-socket", 0, 0, G_OPTION_ARG_FILENAME, &control_socket,
+     "Accept commands on this UNIX socket to show the progress, pause, resume and change the active threads and the maximum throughput. Only the owner can connect, and clients idle for 10 seconds are disconnected", NULL},
+    {"max-throughput", 0, 0, G_OPTION_ARG_INT, &max_throughput,
+     "Maximum KB per second of data written or restored by all the threads together. 0 means no limit, default 0", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_control_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, control_entries);
+}
+
+// Bytes counted by a thread during its current job, throttled when the job
+// ends
+static guint64 *get_pending_bytes(){
+  guint64 *pending=g_private_get(control_pending);
+  if (pending == NULL){
+    pending=g_new0(guint64, 1);
+    g_private_set(control_pending, pending);
+  }
+  return pending;
+}
+
+// Sleeps as long as needed to keep all the threads together under
+// max_throughput
+static void throttle(guint64 bytes){
+  gint64 now=0, wait=0;
+  g_mutex_lock(control_mutex);
+  if (max_throughput > 0){
+    now=g_get_monotonic_time();
+    if (throttle_next < now)
+      throttle_next=now;
+    throttle_next+=(gint64)(bytes * G_USEC_PER_SEC / ((guint64)max_throughput * 1024));
+    wait=throttle_next - now;
+  }
+  g_mutex_unlock(control_mutex);
+  if (wait > 0)
+    g_usleep(wait);
+}
+
+// A thread takes a slot before starting a job and releases it when the job
+// is done, so lowering the active threads takes effect as the running jobs
+// finish. The threads keep their connections while they wait. The active
+// threads set on the socket are a ceiling for the adaptive ones. Pausing
+// also takes effect here, between two jobs.
+void control_job_begin(){
+  if (!control_enabled)
+    return;
+  *get_pending_bytes()=0;
+  g_mutex_lock(control_mutex);
+  while (control_paused || running_jobs >= MIN(active_threads, adaptive_threads))
+    g_cond_wait(control_cond, control_mutex);
+  running_jobs++;
+  g_mutex_unlock(control_mutex);
+}
+
+// The bytes counted during the job are throttled once the slot is released,
+// so the sleep never happens while a result set is open. Bytes counted by
+// jobs that take no slot are not throttled.
+void control_job_end(){
+  guint64 *pending=NULL;
+  if (!control_enabled)
+    return;
+  g_mutex_lock(control_mutex);
+  running_jobs--;
+  finished_jobs++;
+  g_cond_broadcast(control_cond);
+  g_mutex_unlock(control_mutex);
+  pending=get_pending_bytes();
+  throttle(*pending);
+  *pending=0;
+}
+
+// Called with the bytes just written, which count toward max_throughput
+// when the job ends
+void control_count(guint64 bytes){
+  if (!control_enabled)
+    return;
+  g_mutex_lock(control_mutex);
+  control_bytes+=bytes;
+  g_mutex_unlock(control_mutex);
+  *get_pending_bytes()+=bytes;
+}
+
+// Called with the bytes just executed, which are throttled right away. It
+// does not wait while the tool is paused, as it runs inside transactions.
+void control_throttle(guint64 bytes){
+  if (!control_enabled)
+    return;
+  g_mutex_lock(control_mutex);
+  control_bytes+=bytes;
+  g_mutex_unlock(control_mutex);
+  throttle(bytes);
+}
+
+// Waits while the tool is paused. Called where a thread holds no locks on
+// the server, like between two transactions.
+void control_wait_resume(){
+  if (!control_enabled)
+    return;
+  g_mutex_lock(control_mutex);
+  while (control_paused)
+    g_cond_wait(control_cond, control_mutex);
+  g_mutex_unlock(control_mutex);
+}
+
+// Used by the feedback controllers that adapt the concurrency to the load of
+// the server
+void control_set_adaptive_threads(guint threads){
+  if (!control_enabled)
+    return;
+  g_mutex_lock(control_mutex);
+  adaptive_threads=CLAMP(threads, 1, control_threads);
+  g_cond_broadcast(control_cond);
+  g_mutex_unlock(control_mutex);
+}
+
+void control_set_progress(void (*progress)(GString *)){
+  control_progress=progress;
+}
+
+// Must be called with control_mutex locked
+static void append_status(GString *s){
+  gdouble seconds=(gdouble)(g_get_monotonic_time() - control_start) / G_USEC_PER_SEC;
+  g_string_append_printf(s, "tool: %s\nstate: %s\nuptime: %.1f\nactive_threads: %u\nadaptive_threads: %u\nthreads: %u\n"
+                            "running_jobs: %u\nfinished_jobs: %llu\nbytes: %llu\nthroughput_kb: %.1f\nmax_throughput_kb: %u\n",
+                         control_tool, control_paused ? "paused" : "running", seconds, active_threads, adaptive_threads, control_threads,
+                         running_jobs, (unsigned long long)finished_jobs, (unsigned long long)control_bytes,
+                         seconds > 0 ? control_bytes / seconds / 1024 : 0, max_throughput);
+}
+
+static gboolean parse_number(const gchar *value, guint *number){
+  gchar *end=NULL;
+  guint64 n=0;
+  if (value == NULL || *value == '\0')
+    return FALSE;
+  n=g_ascii_strtoull(value, &end, 10);
+  if (*end != '\0' || n > G_MAXUINT)
+    return FALSE;
+  *number=n;
+  return TRUE;
+}
+
+// Commands are one per line and every answer finishes with a line that
+// starts with OK or ERROR
+static void execute_command(const gchar *line, GString *s){
+  gchar **words=g_strsplit_set(line, " \t\r", 0);
+  guint n=0, argc=0;
+  gchar *argv[2]={NULL, NULL};
+  for (n = 0; words[n] != NULL && argc < 2; n++)
+    if (*words[n] != '\0')
+      argv[argc++]=words[n];
+  g_mutex_lock(control_mutex);
+  if (argc == 0){
+    g_string_append(s, "ERROR empty command\n");
+  }else if (!g_ascii_strcasecmp(argv[0], "status")){
+    append_status(s);
+    g_mutex_unlock(control_mutex);
+    if (control_progress != NULL)
+      control_progress(s);
+    g_mutex_lock(control_mutex);
+    g_string_append(s, "OK\n");
+  }else if (!g_ascii_strcasecmp(argv[0], "pause")){
+    control_paused=TRUE;
+    g_message("Paused from the control socket");
+    g_string_append(s, "OK paused\n");
+  }else if (!g_ascii_strcasecmp(argv[0], "resume")){
+    control_paused=FALSE;
+    throttle_next=0;
+    g_cond_broadcast(control_cond);
+    g_message("Resumed from the control socket");
+    g_string_append(s, "OK running\n");
+  }else if (!g_ascii_strcasecmp(argv[0], "threads")){
+    if (!parse_number(argv[1], &n) || n == 0 || n > control_threads){
+      g_string_append_printf(s, "ERROR threads must be between 1 and %u\n", control_threads);
+    }else{
+      active_threads=n;
+      g_cond_broadcast(control_cond);
+      g_message("Active threads set to %u from the control socket", n);
+      g_string_append_printf(s, "OK active_threads: %u\n", n);
+    }
+  }else if (!g_ascii_strcasecmp(argv[0], "throughput")){
+    if (!parse_number(argv[1], &n)){
+      g_string_append(s, "ERROR throughput needs the maximum KB per second, 0 means no limit\n");
+    }else{
+      max_throughput=n;
+      throttle_next=0;
+      g_message("Maximum throughput set to %u KB/s from the control socket", n);
+      g_string_append_printf(s, "OK max_throughput_kb: %u\n", n);
+    }
+  }else if (!g_ascii_strcasecmp(argv[0], "help")){
+    g_string_append(s, "status\npause\nresume\nthreads <1 to --threads>\nthroughput <KB per second, 0 means no limit>\nOK\n");
+  }else{
+    g_string_append_printf(s, "ERROR unknown command %s, try help\n", argv[0]);
+  }
+  g_mutex_unlock(control_mutex);
+  g_strfreev(words);
+}
+
+static void serve_client(int client){
+  char buffer[4096];
+  GString *line=g_string_new("");
+  GString *s=g_string_new("");
+  gchar *eol=NULL;
+  ssize_t len=0;
+  while ((len = read(client, buffer, sizeof(buffer))) > 0 || (len < 0 && errno == EINTR)){
+    if (len < 0)
+      continue;
+    g_string_append_len(line, buffer, len);
+    while ((eol = memchr(line->str, '\n', line->len)) != NULL){
+      *eol='\0';
+      g_string_set_size(s, 0);
+      execute_command(line->str, s);
+      g_string_erase(line, 0, eol - line->str + 1);
+      if (write(client, s->str, s->len) < 0){
+        g_debug("Could not answer on the control socket (%d)", errno);
+        goto cleanup;
+      }
+    }
+    if (line->len > sizeof(buffer))
+      break;
+  }
+cleanup:
+  g_string_free(line, TRUE);
+  g_string_free(s, TRUE);
+  close(client);
+}
+
+// Clients are served one at a time, so a client that stays idle is
+// disconnected after a while to let the next ones in
+static void *control_thread_function(void *data){
+  (void) data;
+  int client=-1;
+  struct timeval timeout={CONTROL_CLIENT_TIMEOUT, 0};
+  while ((client = accept(control_socket_fd, NULL, NULL)) >= 0 || errno == EINTR){
+    if (client < 0)
+      continue;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    serve_client(client);
+  }
+  return NULL;
+}
+
+// adaptive is set when a feedback controller is going to change the number
+// of threads, which needs the slots even without the socket
+void initialize_control(const gchar *tool, guint threads, gboolean adaptive){
+  control_enabled=control_socket != NULL || max_throughput > 0 || adaptive;
+  if (!control_enabled)
+    return;
+  control_tool=tool;
+  control_threads=threads;
+  active_threads=threads;
+  adaptive_threads=threads;
+  control_start=g_get_monotonic_time();
+  control_mutex=g_mutex_new();
+  control_cond=g_cond_new();
+  control_pending=g_private_new(g_free);
+  if (control_socket != NULL){
+    control_socket_fd=listen_on_unix_socket(control_socket);
+    if (control_socket_fd < 0){
+      g_critical("Could not listen on the control socket %s (%d)", control_socket, errno);
+      errors++;
+    }else
+      g_thread_create((GThreadFunc)control_thread_function, NULL, FALSE, NULL);
+  }
+}
+
+// The socket thread is left blocked on accept until the process exits
+void finish_control(){
+  if (control_socket_fd >= 0)
+    unlink(control_socket);
+}
@@ -0,0 +1,33 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_control_h
+#define _src_control_h
+
+extern gboolean control_enabled;
+
+void load_control_entries(GOptionGroup *main_group);
+void initialize_control(const gchar *tool, guint threads, gboolean adaptive);
+void control_set_adaptive_threads(guint threads);
+void control_set_progress(void (*progress)(GString *));
+void control_job_begin();
+void control_job_end();
+void control_count(guint64 bytes);
+void control_throttle(guint64 bytes);
+void control_wait_resume();
+void finish_control();
+#endif
@@ -0,0 +1,388 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mysql.h>
+#include "common.h"
+#include "metrics.h"
+
+extern guint errors;
+
+gboolean metrics_enabled = FALSE;
+gchar *metrics_file = NULL;
+guint metrics_interval = 10;
+guint metrics_port = 0;
+gchar *metrics_socket = NULL;
+
+#define METRICS_CLIENT_TIMEOUT 2
+
+static const gchar *metrics_timer_name[METRICS_TIMERS] = { "fetch", "format", "compress", "write", "query", "commit" };
+
+struct table_metrics {
+  gchar *database;
+  gchar *table;
+  struct metrics_counters counters;
+};
+
+static const gchar *metrics_tool = NULL;
+static GMutex *metrics_mutex = NULL;
+static GHashTable *thread_metrics = NULL;
+static GHashTable *table_metrics = NULL;
+static GPrivate *metrics_thread_id = NULL;
+static GAsyncQueue *metrics_stop = NULL;
+static GThread *metrics_file_thread = NULL;
+static int metrics_port_fd = -1;
+static int metrics_socket_fd = -1;
+static guint64 metrics_start = 0;
+
+static GOptionEntry metrics_entries[] = {
+    {"metrics-file", 0, 0, G_OPTION_ARG_FILENAME, &metrics_file,
+     "Rewrite this file with the counters of every thread and table in JSON", NULL},
+    {"metrics-interval", 0, 0, G_OPTION_ARG_INT, &metrics_interval,
+     "Seconds between two writes of the metrics file. Default 10", NULL},
+    {"metrics-port", 0, 0, G_OPTION_ARG_INT, &metrics_port,
+     "Serve the counters in the Prometheus text format on this port of 127.0.0.1", NULL},
+    {"metrics-socket", 0, 0, G_OPTION_ARG_FILENAME, &metrics_socket,
+     "Serve the counters in the Prometheus text format on this UNIX socket, which only the owner can connect to", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_metrics_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, metrics_entries);
+}
+
+guint64 metrics_now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Threads that are not registered, like the main thread, are reported as
+// thread 0
+void metrics_set_thread(guint thread_id){
+  if (metrics_enabled)
+    g_private_set(metrics_thread_id, GUINT_TO_POINTER(thread_id + 1));
+}
+
+static void add_counters(struct metrics_counters *to, struct metrics_counters *from){
+  guint i;
+  to->rows+=from->rows;
+  to->bytes+=from->bytes;
+  to->compressed_bytes+=from->compressed_bytes;
+  for (i = 0; i < METRICS_TIMERS; i++)
+    to->ns[i]+=from->ns[i];
+}
+
+// Returns the totals of a table, creating them the first time, so a thread
+// that flushes often can look the table up once and keep the entry
+struct table_metrics *metrics_table(const gchar *database, const gchar *table){
+  if (!metrics_enabled || database == NULL || table == NULL)
+    return NULL;
+  gchar *key=g_strdup_printf("%s.%s", database, table);
+  g_mutex_lock(metrics_mutex);
+  struct table_metrics *tm=g_hash_table_lookup(table_metrics, key);
+  if (tm == NULL){
+    tm=g_new0(struct table_metrics, 1);
+    tm->database=g_strdup(database);
+    tm->table=g_strdup(table);
+    g_hash_table_insert(table_metrics, key, tm);
+  }else{
+    g_free(key);
+  }
+  g_mutex_unlock(metrics_mutex);
+  return tm;
+}
+
+// Adds the counters collected by the calling thread to its totals and to
+// the totals of the table, if any, and resets them. The threads keep their
+// counters locally and flush them once per job or transaction, so the lock
+// is not taken per row.
+void metrics_flush_table(struct table_metrics *tm, struct metrics_counters *mc){
+  if (!metrics_enabled)
+    return;
+  guint thread_id=GPOINTER_TO_UINT(g_private_get(metrics_thread_id));
+  thread_id=thread_id > 0 ? thread_id - 1 : 0;
+  g_mutex_lock(metrics_mutex);
+  struct metrics_counters *tc=g_hash_table_lookup(thread_metrics, GUINT_TO_POINTER(thread_id));
+  if (tc == NULL){
+    tc=g_new0(struct metrics_counters, 1);
+    g_hash_table_insert(thread_metrics, GUINT_TO_POINTER(thread_id), tc);
+  }
+  add_counters(tc, mc);
+  if (tm != NULL)
+    add_counters(&(tm->counters), mc);
+  g_mutex_unlock(metrics_mutex);
+  memset(mc, 0, sizeof(struct metrics_counters));
+}
+
+void metrics_flush(const gchar *database, const gchar *table, struct metrics_counters *mc){
+  if (metrics_enabled)
+    metrics_flush_table(metrics_table(database, table), mc);
+}
+
+static gint compare_thread_id(gconstpointer a, gconstpointer b){
+  guint x=GPOINTER_TO_UINT(a), y=GPOINTER_TO_UINT(b);
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void append_json_counters(GString *s, struct metrics_counters *mc){
+  guint i;
+  g_string_append_printf(s, "\"rows\": %llu, \"bytes\": %llu, \"compressed_bytes\": %llu, \"ns\": {",
+                         (unsigned long long)mc->rows, (unsigned long long)mc->bytes,
+                         (unsigned long long)mc->compressed_bytes);
+  for (i = 0; i < METRICS_TIMERS; i++)
+    g_string_append_printf(s, "%s\"%s\": %llu", i ? ", " : "", metrics_timer_name[i], (unsigned long long)mc->ns[i]);
+  g_string_append(s, "}");
+}
+
+// Must be called with metrics_mutex locked
+static GString *build_json(){
+  GString *s=g_string_new("");
+  GList *keys=NULL, *e=NULL;
+  g_string_append_printf(s, "{\n  \"tool\": \"%s\",\n  \"uptime_ns\": %llu,\n  \"threads\": [",
+                         metrics_tool, (unsigned long long)(metrics_now() - metrics_start));
+  keys=g_list_sort(g_hash_table_get_keys(thread_metrics), compare_thread_id);
+  for (e = keys; e != NULL; e = e->next){
+    g_string_append_printf(s, "%s\n    {\"thread\": %u, ", e == keys ? "" : ",", GPOINTER_TO_UINT(e->data));
+    append_json_counters(s, g_hash_table_lookup(thread_metrics, e->data));
+    g_string_append(s, "}");
+  }
+  g_list_free(keys);
+  g_string_append(s, "\n  ],\n  \"tables\": [");
+  keys=g_list_sort(g_hash_table_get_keys(table_metrics), (GCompareFunc)g_strcmp0);
+  for (e = keys; e != NULL; e = e->next){
+    struct table_metrics *tm=g_hash_table_lookup(table_metrics, e->data);
+    g_string_append_printf(s, "%s\n    {\"database\": ", e == keys ? "" : ",");
+    append_json_string(s, tm->database);
+    g_string_append(s, ", \"table\": ");
+    append_json_string(s, tm->table);
+    g_string_append(s, ", ");
+    append_json_counters(s, &(tm->counters));
+    g_string_append(s, "}");
+  }
+  g_list_free(keys);
+  g_string_append(s, "\n  ]\n}\n");
+  return s;
+}
+
+static void append_label_value(GString *s, const gchar *str){
+  const gchar *c=NULL;
+  for (c = str; *c != '\0'; c++){
+    if (*c == '"' || *c == '\\')
+      g_string_append_printf(s, "\\%c", *c);
+    else if (*c == '\n')
+      g_string_append(s, "\\n");
+    else
+      g_string_append_c(s, *c);
+  }
+}
+
+static void append_prometheus_family(GString *s, const gchar *scope, const gchar *family, GPtrArray *labels, GPtrArray *counters, glong offset){
+  guint i;
+  g_string_append_printf(s, "# TYPE %s_%s_%s counter\n", metrics_tool, scope, family);
+  for (i = 0; i < counters->len; i++)
+    g_string_append_printf(s, "%s_%s_%s{%s} %llu\n", metrics_tool, scope, family, (gchar *)g_ptr_array_index(labels, i),
+                           (unsigned long long)G_STRUCT_MEMBER(guint64, g_ptr_array_index(counters, i), offset));
+}
+
+// The exposition format needs all the samples of a family together after
+// its TYPE line, so every family is written for all the threads or tables
+// before the next one
+static void append_prometheus_scope(GString *s, const gchar *scope, GPtrArray *labels, GPtrArray *counters){
+  guint i, t;
+  struct metrics_counters *mc=NULL;
+  append_prometheus_family(s, scope, "rows_total", labels, counters, G_STRUCT_OFFSET(struct metrics_counters, rows));
+  append_prometheus_family(s, scope, "bytes_total", labels, counters, G_STRUCT_OFFSET(struct metrics_counters, bytes));
+  append_prometheus_family(s, scope, "compressed_bytes_total", labels, counters, G_STRUCT_OFFSET(struct metrics_counters, compressed_bytes));
+  g_string_append_printf(s, "# TYPE %s_%s_seconds_total counter\n", metrics_tool, scope);
+  for (i = 0; i < counters->len; i++){
+    mc=g_ptr_array_index(counters, i);
+    for (t = 0; t < METRICS_TIMERS; t++)
+      g_string_append_printf(s, "%s_%s_seconds_total{%s,phase=\"%s\"} %.9f\n", metrics_tool, scope,
+                             (gchar *)g_ptr_array_index(labels, i), metrics_timer_name[t], (double)mc->ns[t] / 1000000000);
+  }
+  for (i = 0; i < labels->len; i++)
+    g_free(g_ptr_array_index(labels, i));
+  g_ptr_array_set_size(labels, 0);
+  g_ptr_array_set_size(counters, 0);
+}
+
+// Must be called with metrics_mutex locked
+static GString *build_prometheus(){
+  GString *s=g_string_new("");
+  GString *label=g_string_new("");
+  GPtrArray *labels=g_ptr_array_new();
+  GPtrArray *counters=g_ptr_array_new();
+  GList *keys=NULL, *e=NULL;
+  g_string_append_printf(s, "# TYPE %s_uptime_seconds gauge\n%s_uptime_seconds %.3f\n", metrics_tool, metrics_tool,
+                         (double)(metrics_now() - metrics_start) / 1000000000);
+  keys=g_list_sort(g_hash_table_get_keys(thread_metrics), compare_thread_id);
+  for (e = keys; e != NULL; e = e->next){
+    g_ptr_array_add(labels, g_strdup_printf("thread=\"%u\"", GPOINTER_TO_UINT(e->data)));
+    g_ptr_array_add(counters, g_hash_table_lookup(thread_metrics, e->data));
+  }
+  g_list_free(keys);
+  append_prometheus_scope(s, "thread", labels, counters);
+  keys=g_list_sort(g_hash_table_get_keys(table_metrics), (GCompareFunc)g_strcmp0);
+  for (e = keys; e != NULL; e = e->next){
+    struct table_metrics *tm=g_hash_table_lookup(table_metrics, e->data);
+    g_string_assign(label, "database=\"");
+    append_label_value(label, tm->database);
+    g_string_append(label, "\",table=\"");
+    append_label_value(label, tm->table);
+    g_string_append_c(label, '"');
+    g_ptr_array_add(labels, g_strdup(label->str));
+    g_ptr_array_add(counters, &(tm->counters));
+  }
+  g_list_free(keys);
+  append_prometheus_scope(s, "table", labels, counters);
+  g_ptr_array_free(labels, TRUE);
+  g_ptr_array_free(counters, TRUE);
+  g_string_free(label, TRUE);
+  return s;
+}
+
+// The file is replaced atomically so readers never see it half written
+static void write_metrics_file(){
+  gchar *tmp=g_strdup_printf("%s.tmp", metrics_file);
+  g_mutex_lock(metrics_mutex);
+  GString *s=build_json();
+  g_mutex_unlock(metrics_mutex);
+  if (!g_file_set_contents(tmp, s->str, s->len, NULL) || g_rename(tmp, metrics_file) != 0)
+    g_warning("Could not write the metrics file %s (%d)", metrics_file, errno);
+  g_string_free(s, TRUE);
+  g_free(tmp);
+}
+
+static void *metrics_file_thread_function(void *data){
+  (void) data;
+  GTimeVal tv;
+  while (1){
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, (glong)metrics_interval * G_USEC_PER_SEC);
+    if (g_async_queue_timed_pop(metrics_stop, &tv) != NULL)
+      break;
+    write_metrics_file();
+  }
+  return NULL;
+}
+
+// Answers every connection with the Prometheus exposition as an HTTP/1.0
+// response, the request itself is not parsed
+static void *metrics_server_thread_function(void *data){
+  int fd=GPOINTER_TO_INT(data);
+  int client=-1;
+  char buffer[4096];
+  // A client that connects and sends nothing must not hold the only thread
+  // that answers the scrapes
+  struct timeval timeout={METRICS_CLIENT_TIMEOUT, 0};
+  while ((client = accept(fd, NULL, NULL)) >= 0 || errno == EINTR){
+    if (client < 0)
+      continue;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (read(client, buffer, sizeof(buffer)) < 0){
+      close(client);
+      continue;
+    }
+    g_mutex_lock(metrics_mutex);
+    GString *s=build_prometheus();
+    g_mutex_unlock(metrics_mutex);
+    g_string_prepend(s, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+    if (write(client, s->str, s->len) < 0)
+      g_debug("Could not send the metrics (%d)", errno);
+    g_string_free(s, TRUE);
+    close(client);
+  }
+  return NULL;
+}
+
+static int listen_on_port(guint port){
+  struct sockaddr_in addr;
+  int one=1;
+  int fd=socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family=AF_INET;
+  addr.sin_port=htons(port);
+  addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void initialize_metrics(const gchar *tool){
+  metrics_enabled=metrics_file != NULL || metrics_port > 0 || metrics_socket != NULL;
+  if (!metrics_enabled)
+    return;
+  metrics_tool=tool;
+  metrics_start=metrics_now();
+  metrics_mutex=g_mutex_new();
+  thread_metrics=g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  table_metrics=g_hash_table_new(g_str_hash, g_str_equal);
+  metrics_thread_id=g_private_new(NULL);
+  if (metrics_file != NULL){
+    if (metrics_interval == 0)
+      metrics_interval=1;
+    metrics_stop=g_async_queue_new();
+    metrics_file_thread=g_thread_create((GThreadFunc)metrics_file_thread_function, NULL, TRUE, NULL);
+  }
+  if (metrics_port > 0){
+    metrics_port_fd=listen_on_port(metrics_port);
+    if (metrics_port_fd < 0){
+      g_critical("Could not listen on port %u for the metrics (%d)", metrics_port, errno);
+      errors++;
+    }else
+      g_thread_create((GThreadFunc)metrics_server_thread_function, GINT_TO_POINTER(metrics_port_fd), FALSE, NULL);
+  }
+  if (metrics_socket != NULL){
+    metrics_socket_fd=listen_on_unix_socket(metrics_socket);
+    if (metrics_socket_fd < 0){
+      g_critical("Could not listen on socket %s for the metrics (%d)", metrics_socket, errno);
+      errors++;
+    }else
+      g_thread_create((GThreadFunc)metrics_server_thread_function, GINT_TO_POINTER(metrics_socket_fd), FALSE, NULL);
+  }
+}
+
+// Writes the final counters. The server threads are left blocked on accept
+// until the process exits.
+void finish_metrics(){
+  if (!metrics_enabled)
+    return;
+  if (metrics_file != NULL){
+    g_async_queue_push(metrics_stop, GINT_TO_POINTER(1));
+    g_thread_join(metrics_file_thread);
+    write_metrics_file();
+  }
+  if (metrics_socket_fd >= 0)
+    unlink(metrics_socket);
+}
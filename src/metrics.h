@@ -0,0 +1,42 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_metrics_h
+#define _src_metrics_h
+
+enum metrics_timer { METRICS_FETCH, METRICS_FORMAT, METRICS_COMPRESS, METRICS_WRITE, METRICS_QUERY, METRICS_COMMIT, METRICS_TIMERS };
+
+struct metrics_counters {
+  guint64 rows;
+  guint64 bytes;
+  guint64 compressed_bytes;
+  guint64 ns[METRICS_TIMERS];
+};
+
+struct table_metrics;
+
+extern gboolean metrics_enabled;
+
+void load_metrics_entries(GOptionGroup *main_group);
+void initialize_metrics(const gchar *tool);
+void metrics_set_thread(guint thread_id);
+guint64 metrics_now();
+struct table_metrics *metrics_table(const gchar *database, const gchar *table);
+void metrics_flush_table(struct table_metrics *tm, struct metrics_counters *mc);
+void metrics_flush(const gchar *database, const gchar *table, struct metrics_counters *mc);
+void finish_metrics();
+#endif
@@ -33,10 +33,91 @@ extern guint errors;
 GMutex *ref_table_mutex = NULL;
 GHashTable *ref_table=NULL;
 guint table_number=0;
+static GMutex *manifest_mutex = NULL;
+static GHashTable *manifest_data_files = NULL;
+
+struct manifest_entry {
+  gchar *database;
+  gchar *table;
+  guint part;
+  guint sub_part;
+  guint64 rows;
+  gchar *where;
+  gboolean has_checksum;
+  guint64 checksum;
+};
 
 void initialize_common(){
   ref_table_mutex = g_mutex_new();
   ref_table=g_hash_table_new ( g_str_hash, g_str_equal );
+  manifest_mutex = g_mutex_new();
+  manifest_data_files=g_hash_table_new ( g_str_hash, g_str_equal );
+}
+
+// Called by the writers when a data file is closed, so the manifest can
+// describe it without parsing its name
+void register_data_file(const gchar *filename, char *database, char *table, guint part, guint sub_part, guint64 rows, const gchar *where,
+                        gboolean has_checksum, guint64 checksum){
+  struct manifest_entry *me=g_new(struct manifest_entry, 1);
+  me->database=g_strdup(database);
+  me->table=g_strdup(table);
+  me->part=part;
+  me->sub_part=sub_part;
+  me->rows=rows;
+  me->where=where ? g_strescape(where, NULL) : g_strdup("");
+  me->has_checksum=has_checksum;
+  me->checksum=checksum;
+  g_mutex_lock(manifest_mutex);
+  g_hash_table_insert(manifest_data_files, g_path_get_basename(filename), me);
+  g_mutex_unlock(manifest_mutex);
+}
+
+// The manifest lists every file of the dump, one per line. Data files also
+// have their database, table, part, sub part, size, rows, WHERE and the
+// checksum of their rows separated by tabs, so myloader can plan the
+// restore without listing the directory. The checksum is empty when
+// --chunk-checksums is not used. It is written once the dump has finished.
+void write_manifest(gchar *directory){
+  GError *error = NULL;
+  GDir *dir = g_dir_open(directory, 0, &error);
+  if (error) {
+    g_critical("cannot open directory %s to write the manifest, %s", directory, error->message);
+    errors++;
+    return;
+  }
+  gchar *p=g_build_filename(directory, "manifest.partial", NULL);
+  gchar *p2=g_build_filename(directory, "manifest", NULL);
+  FILE *file=g_fopen(p, "w");
+  if (!file){
+    g_critical("Couldn't write manifest file %s (%d)", p, errno);
+    errors++;
+    g_dir_close(dir);
+    return;
+  }
+  fprintf(file, "# mydumper manifest 1\n");
+  const gchar *filename = NULL;
+  struct manifest_entry *me=NULL;
+  struct stat st;
+  while ((filename = g_dir_read_name(dir))){
+    if (!strcmp(filename, "manifest.partial"))
+      continue;
+    me=g_hash_table_lookup(manifest_data_files, filename);
+    gchar *path=g_build_filename(directory, filename, NULL);
+    if (me != NULL && g_stat(path, &st) == 0){
+      fprintf(file, "%s\t%s\t%s\t%u\t%u\t%llu\t%llu\t%s\t", filename, me->database, me->table, me->part, me->sub_part,
+              (unsigned long long)st.st_size, (unsigned long long)me->rows, me->where);
+      if (me->has_checksum)
+        fprintf(file, "%016llx", (unsigned long long)me->checksum);
+      fprintf(file, "\n");
+    }else
+      fprintf(file, "%s\n", filename);
+    g_free(path);
+  }
+  g_dir_close(dir);
+  fclose(file);
+  g_rename(p, p2);
+  g_free(p);
+  g_free(p2);
 }
 
 char * determine_filename (char * table){
@@ -19,6 +19,9 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 void initialize_common();
+void register_data_file(const gchar *filename, char *database, char *table, guint part, guint sub_part, guint64 rows, const gchar *where,
+                        gboolean has_checksum, guint64 checksum);
+void write_manifest(gchar *directory);
 gchar *get_ref_table(gchar *k);
 char * determine_filename (char * table);
 char * escape_string(MYSQL *conn, char *str);
@@ -29,6 +29,7 @@
 #include <glib-unix.h>
 #include "mydumper_start_dump.h"
 #include "mydumper_common.h"
+#include "trace.h"
 
 guint snapshot_interval = 60;
 guint snapshot_count= 2;
@@ -116,6 +117,7 @@ void *exec_thread(void *data) {
     g_free(dump_number_str);
     clear_dump_directory(dump_directory);
     start_dump();
+    checkpoint_trace();
     // start_dump already closes mysql
     // mysql_close(conn);
     // mysql_thread_end();
@@ -32,6 +32,7 @@
 #include "mydumper_common.h"
 #include "mydumper_jobs.h"
 #include "mydumper_database.h"
+#include "trace.h"
 
 extern gboolean success_on_1146;
 extern int detected_server;
@@ -48,6 +49,9 @@ extern gboolean dump_events;
 extern gboolean use_savepoints;
 extern gint database_counter;
 extern guint rows_per_file;
+extern gboolean dump_checksums;
+extern gboolean dump_checksums_per_chunk;
+extern gchar *where_option;
 extern gint non_innodb_table_counter;
 gboolean dump_triggers = FALSE;
 gboolean split_partitions = FALSE;
@@ -594,6 +598,52 @@ void write_table_checksum_into_file(MYSQL *conn, char *database, char *table, ch
   return;
 }
 
+// Each line of the file has the number of rows and the checksum of a chunk
+// followed by its WHERE, escaped. A chunk that failed is left empty.
+void write_table_checksum_chunk(MYSQL *conn, struct table_checksum_job *tcj) {
+  struct table_checksum_chunks *tcc = tcj->chunks;
+  int errn=0;
+  guint i;
+  gchar *query=NULL;
+  // The columns are read by the first chunk, not by the main connection
+  // while the tables are locked
+  g_mutex_lock(tcc->mutex);
+  if (tcc->query == NULL)
+    tcc->query=build_chunk_checksum_query(conn, tcj->database, tcj->table, &errn);
+  query=tcc->query;
+  g_mutex_unlock(tcc->mutex);
+  if (query != NULL)
+    tcc->results[tcj->nchunk]=checksum_chunk(conn, query, tcc->wheres[tcj->nchunk], &errn);
+  if (errn != 0 && !(success_on_1146 && errn == 1146))
+    errors++;
+  if (!g_atomic_int_dec_and_test(&tcc->pending))
+    return;
+
+  FILE *outfile = g_fopen(tcc->filename, "w");
+  if (!outfile) {
+    g_critical("Error: DB: %s TABLE: %s Could not create output file %s (%d)",
+               tcj->database, tcj->table, tcc->filename, errno);
+    errors++;
+  } else {
+    fprintf(outfile, "# mydumper chunk checksums 1\n");
+    for (i = 0; i < tcc->count; i++) {
+      gchar *where = g_strescape(tcc->wheres[i] ? tcc->wheres[i] : "", NULL);
+      fprintf(outfile, "%s\t%s\n", tcc->results[i] ? tcc->results[i] : "", where);
+      g_free(where);
+    }
+    fclose(outfile);
+    if (stream) g_async_queue_push(stream_queue, g_strdup(tcc->filename));
+  }
+  g_free(tcc->filename);
+  g_free(tcc->query);
+  g_mutex_free(tcc->mutex);
+  g_strfreev(tcc->wheres);
+  for (i = 0; i < tcc->count; i++)
+    g_free(tcc->results[i]);
+  g_free(tcc->results);
+  g_free(tcc);
+}
+
 void free_schema_job(struct schema_job *sj){
   if (sj->table)
     g_free(sj->table);
@@ -634,46 +684,56 @@ void free_table_checksum_job(struct table_checksum_job*tcj){
 
 void do_JOB_CREATE_DATABASE(struct thread_data *td, struct job *job){
   struct create_database_job * cdj = (struct create_database_job *)job->job_data;
+  guint64 ts=trace_begin();
   g_message("Thread %d dumping schema create for `%s`", td->thread_id,
             cdj->database);
   write_schema_definition_into_file(td->thrconn, cdj->database, cdj->filename);
+  trace_end(ts, "create database", "schema", cdj->database, NULL, 0);
   free_create_database_job(cdj);
   g_free(job);
 }
 
 void do_JOB_SCHEMA_POST(struct thread_data *td, struct job *job){
   struct schema_post_job * sp = (struct schema_post_job *)job->job_data;
+  guint64 ts=trace_begin();
   g_message("Thread %d dumping SP and VIEWs for `%s`", td->thread_id,
             sp->database->name);
   write_routines_definition_into_file(td->thrconn, sp->database, sp->filename);
+  trace_end(ts, "schema post", "schema", sp->database->name, NULL, 0);
   free_schema_post_job(sp);
   g_free(job);
 }
 
 void do_JOB_VIEW(struct thread_data *td, struct job *job){
   struct view_job * vj = (struct view_job *)job->job_data;
+  guint64 ts=trace_begin();
   g_message("Thread %d dumping view for `%s`.`%s`", td->thread_id,
             vj->database, vj->table);
   write_view_definition_into_file(td->thrconn, vj->database, vj->table, vj->filename,
                  vj->filename2);
+  trace_end(ts, "view", "schema", vj->database, vj->table, 0);
   free_view_job(vj);
   g_free(job);
 }
 
 void do_JOB_SCHEMA(struct thread_data *td, struct job *job){
   struct schema_job *sj = (struct schema_job *)job->job_data;
+  guint64 ts=trace_begin();
   g_message("Thread %d dumping schema for `%s`.`%s`", td->thread_id,
             sj->database, sj->table);
   write_table_definition_into_file(td->thrconn, sj->database, sj->table, sj->filename);
+  trace_end(ts, "schema", "schema", sj->database, sj->table, 0);
   free_schema_job(sj);
   g_free(job);
 }
 
 void do_JOB_TRIGGERS(struct thread_data *td, struct job *job){
   struct schema_job * sj = (struct schema_job *)job->job_data;
+  guint64 ts=trace_begin();
   g_message("Thread %d dumping triggers for `%s`.`%s`", td->thread_id,
             sj->database, sj->table);
   write_triggers_definition_into_file(td->thrconn, sj->database, sj->table, sj->filename);
+  trace_end(ts, "triggers", "schema", sj->database, sj->table, 0);
   free_schema_job(sj);
   g_free(job);
 }
@@ -681,16 +741,25 @@ void do_JOB_TRIGGERS(struct thread_data *td, struct job *job){
 
 void do_JOB_CHECKSUM(struct thread_data *td, struct job *job){
   struct table_checksum_job *tcj = (struct table_checksum_job *)job->job_data;
-  g_message("Thread %d dumping checksum for `%s`.`%s`", td->thread_id,
-            tcj->database, tcj->table);
+  guint64 ts=trace_begin();
+  if (tcj->chunks)
+    g_message("Thread %d dumping checksum for `%s`.`%s` chunk %u of %u", td->thread_id,
+              tcj->database, tcj->table, tcj->nchunk + 1, tcj->chunks->count);
+  else
+    g_message("Thread %d dumping checksum for `%s`.`%s`", td->thread_id,
+              tcj->database, tcj->table);
   if (use_savepoints && mysql_query(td->thrconn, "SAVEPOINT mydumper")) {
     g_critical("Savepoint failed: %s", mysql_error(td->thrconn));
   }
-  write_table_checksum_into_file(td->thrconn, tcj->database, tcj->table, tcj->filename);
+  if (tcj->chunks)
+    write_table_checksum_chunk(td->thrconn, tcj);
+  else
+    write_table_checksum_into_file(td->thrconn, tcj->database, tcj->table, tcj->filename);
   if (use_savepoints &&
       mysql_query(td->thrconn, "ROLLBACK TO SAVEPOINT mydumper")) {
     g_critical("Rollback to savepoint failed: %s", mysql_error(td->thrconn));
   }
+  trace_end(ts, "checksum", "checksum", tcj->database, tcj->table, 0);
   free_table_checksum_job(tcj);
   g_free(job);
 }
@@ -782,7 +851,52 @@ void create_job_to_dump_post(struct database *database, struct configuration *co
   return;
 }
 
-void create_job_to_dump_checksum(struct db_table * dbt, struct configuration *conf) {
+// The rows of a chunk are the ones that its data job dumps, so --where is
+// added to the WHERE of the chunk
+static gchar *build_chunk_where(const gchar *chunk_where){
+  if (chunk_where == NULL)
+    return g_strdup(where_option);
+  if (where_option == NULL)
+    return g_strdup(chunk_where);
+  return g_strdup_printf("(%s) AND (%s)", chunk_where, where_option);
+}
+
+// Splits the checksum of the table with the same chunks that are used to
+// dump its data, one job per chunk. Without --rows, or when the table can
+// not be chunked, the whole table is a single chunk.
+static void create_job_to_dump_checksum_chunks(struct db_table * dbt, struct configuration *conf, GList *chunks) {
+  guint n=0;
+  GList *iter = NULL;
+  struct table_checksum_chunks *tcc = g_new0(struct table_checksum_chunks, 1);
+  tcc->filename = build_meta_filename(dbt->database->filename, dbt->table_filename,"checksum");
+  tcc->mutex = g_mutex_new();
+  tcc->count = chunks ? g_list_length(chunks) : 1;
+  tcc->wheres = g_new0(gchar *, tcc->count + 1);
+  tcc->results = g_new0(gchar *, tcc->count);
+  tcc->pending = tcc->count;
+  if (chunks == NULL)
+    tcc->wheres[0] = build_chunk_where(NULL);
+  for (iter = chunks; iter != NULL; iter = iter->next)
+    tcc->wheres[n++] = build_chunk_where(iter->data);
+  for (n = 0; n < tcc->count; n++) {
+    struct job *j = g_new0(struct job, 1);
+    struct table_checksum_job *tcj = g_new0(struct table_checksum_job, 1);
+    j->job_data = (void *)tcj;
+    tcj->database = dbt->database->name;
+    tcj->table = g_strdup(dbt->table);
+    tcj->chunks = tcc;
+    tcj->nchunk = n;
+    j->conf = conf;
+    j->type = JOB_CHECKSUM;
+    g_async_queue_push(conf->queue, j);
+  }
+}
+
+static void create_job_to_dump_checksum(struct db_table * dbt, struct configuration *conf, GList *chunks) {
+  if (dump_checksums_per_chunk) {
+    create_job_to_dump_checksum_chunks(dbt, conf, chunks);
+    return;
+  }
   struct job *j = g_new0(struct job, 1);
   struct table_checksum_job *tcj = g_new0(struct table_checksum_job, 1);
   j->job_data = (void *)tcj;
@@ -1159,6 +1273,10 @@ void create_job_to_dump_table(MYSQL *conn, struct db_table *dbt,
   if (rows_per_file)
     chunks = get_chunks_for_table(conn, dbt->database->name, dbt->table, conf);
 
+  // The checksums are split with the chunks of the data
+  if (dump_checksums || dump_checksums_per_chunk)
+    create_job_to_dump_checksum(dbt, conf, chunks);
+
   gboolean has_generated_fields =
     detect_generated_fields(conn, dbt);
 
@@ -0,0 +1,85 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <string.h>
+#include "common.h"
+#include "mydumper_row.h"
+
+/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
+#ifndef MYSQL_TYPE_JSON
+#define MYSQL_TYPE_JSON 245
+#endif
+
+extern gboolean load_data;
+extern gchar *fields_enclosed_by;
+extern gchar *fields_terminated_by;
+extern gchar *lines_starting_by;
+extern gchar *lines_terminated_by;
+
+// Appends the row to statement_row as it is written in the data file: a
+// tuple of an INSERT or a line of a LOAD DATA file. The values are taken
+// through the anonymized functions of the table, if any. escaped is only a
+// buffer reused between calls.
+void write_row_into_string(MYSQL *conn, MYSQL_ROW row, MYSQL_FIELD *fields, gulong *lengths, guint num_fields,
+                           GList *anonymized_function, GString *escaped, GString *statement_row){
+  guint i;
+  GList *f = anonymized_function;
+  gchar * (*fun_ptr)(gchar **) = &identity_function;
+  g_string_append(statement_row, lines_starting_by);
+  for (i = 0; i < num_fields; i++) {
+    if (f){
+      fun_ptr=f->data;
+      f=f->next;
+    }
+    if (load_data){
+      if (!row[i]) {
+        g_string_append(statement_row, "\\N");
+      }else if (fields[i].type != MYSQL_TYPE_LONG && fields[i].type != MYSQL_TYPE_LONGLONG  && fields[i].type != MYSQL_TYPE_INT24  && fields[i].type != MYSQL_TYPE_SHORT ){
+        g_string_append(statement_row,fields_enclosed_by);
+        g_string_set_size(escaped, lengths[i] * 2 + 1);
+        mysql_real_escape_string(conn, escaped->str, fun_ptr(&(row[i])), lengths[i]);
+        g_string_append(statement_row,escaped->str);
+        g_string_append(statement_row,fields_enclosed_by);
+      }else
+        g_string_append(statement_row,fun_ptr(&(row[i])));
+    }else{
+      /* Don't escape safe formats, saves some time */
+      if (!row[i]) {
+        g_string_append(statement_row, "NULL");
+      } else if (fields[i].flags & NUM_FLAG) {
+        g_string_append(statement_row, fun_ptr(&(row[i])));
+      } else {
+        /* We reuse buffers for string escaping, growing is expensive just at
+         * the beginning */
+        g_string_set_size(escaped, lengths[i] * 2 + 1);
+        mysql_real_escape_string(conn, escaped->str, fun_ptr(&(row[i])), lengths[i]);
+        if (fields[i].type == MYSQL_TYPE_JSON)
+          g_string_append(statement_row, "CONVERT(");
+        g_string_append_c(statement_row, '\"');
+        g_string_append(statement_row, escaped->str);
+        g_string_append_c(statement_row, '\"');
+        if (fields[i].type == MYSQL_TYPE_JSON)
+          g_string_append(statement_row, " USING UTF8MB4)");
+      }
+    }
+    if (i < num_fields - 1)
+      g_string_append(statement_row, fields_terminated_by);
+  }
+  g_string_append(statement_row, lines_terminated_by);
+}
@@ -0,0 +1,22 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_mydumper_row_h
+#define _src_mydumper_row_h
+void write_row_into_string(MYSQL *conn, MYSQL_ROW row, MYSQL_FIELD *fields, gulong *lengths, guint num_fields,
+                           GList *anonymized_function, GString *escaped, GString *statement_row);
+#endif
@@ -0,0 +1,109 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include "connection.h"
+#include "common.h"
+#include "control.h"
+#include "mydumper_server_health.h"
+
+extern guint num_threads;
+
+guint health_check_interval = 0;
+guint max_threads_running = 0;
+guint max_replica_lag = 0;
+
+static GAsyncQueue *health_stop = NULL;
+static GThread *health_thread = NULL;
+
+static GOptionEntry server_health_entries[] = {
+    {"health-check-interval", 0, 0, G_OPTION_ARG_INT, &health_check_interval,
+     "Seconds between two checks of the load of the server, which reduce the threads dumping when a limit is exceeded and increase them back when the server recovers. 0 disables it, default 0", NULL},
+    {"max-threads-running", 0, 0, G_OPTION_ARG_INT, &max_threads_running,
+     "Threads_running of the server, including the threads of mydumper, above which fewer threads are used. 0 means no limit, default 0", NULL},
+    {"max-replica-lag", 0, 0, G_OPTION_ARG_INT, &max_replica_lag,
+     "Seconds_Behind_Master above which fewer threads are used when dumping from a replica. 0 means no limit, default 0", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_server_health_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, server_health_entries);
+}
+
+// Values that are not known do not count
+static gboolean is_over(gint64 value, guint limit){
+  return limit > 0 && value >= 0 && value > limit;
+}
+
+static gboolean is_relaxed(gint64 value, guint limit){
+  return limit == 0 || value < 0 || value * 10 <= (gint64)limit * 8;
+}
+
+// Halves the threads when any limit is exceeded and adds one back per check
+// while all the values stay under 80% of their limits. The InnoDB history
+// list length is not checked: the snapshot of the dump itself keeps it
+// growing, whatever the number of threads.
+static void *server_health_thread(void *data){
+  (void) data;
+  MYSQL *conn=mysql_init(NULL);
+  guint threads=num_threads, next=0;
+  gint64 running=-1, lag=-1;
+  GTimeVal tv;
+  m_connect(conn, "mydumper", NULL);
+  while (1){
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, (glong)health_check_interval * G_USEC_PER_SEC);
+    if (g_async_queue_timed_pop(health_stop, &tv) != NULL)
+      break;
+    if (max_threads_running > 0)
+      running=get_server_value(conn, "SHOW GLOBAL STATUS LIKE 'Threads_running'", 1);
+    if (max_replica_lag > 0)
+      lag=get_replica_lag(conn);
+    next=threads;
+    if (is_over(running, max_threads_running) || is_over(lag, max_replica_lag))
+      next=MAX(threads / 2, 1);
+    else if (is_relaxed(running, max_threads_running) && is_relaxed(lag, max_replica_lag))
+      next=MIN(threads + 1, num_threads);
+    if (next != threads){
+      g_message("Threads_running: %lld, replica lag: %lld. Dumping with %u threads",
+                (long long)running, (long long)lag, next);
+      threads=next;
+      control_set_adaptive_threads(threads);
+    }
+  }
+  mysql_close(conn);
+  mysql_thread_end();
+  return NULL;
+}
+
+void start_server_health(){
+  if (health_check_interval == 0)
+    return;
+  health_stop=g_async_queue_new();
+  health_thread=g_thread_create((GThreadFunc)server_health_thread, NULL, TRUE, NULL);
+}
+
+// All the threads are allowed again, the next dump of the daemon mode
+// starts from --threads
+void stop_server_health(){
+  if (health_thread == NULL)
+    return;
+  g_async_queue_push(health_stop, GINT_TO_POINTER(1));
+  g_thread_join(health_thread);
+  g_async_queue_unref(health_stop);
+  health_thread=NULL;
+  control_set_adaptive_threads(num_threads);
+}
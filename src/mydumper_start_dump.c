@@ -19,9 +19,6 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 
-#define _LARGEFILE64_SOURCE
-#define _FILE_OFFSET_BITS 64
-
 #include <mysql.h>
 
 #if defined MARIADB_CLIENT_VERSION_STR && !defined MYSQL_SERVER_VERSION
@@ -67,6 +64,9 @@
 #include "mydumper_stream.h"
 #include "mydumper_database.h"
 #include "mydumper_working_thread.h"
+#include "trace.h"
+#include "control.h"
+#include "mydumper_server_health.h"
 /* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
 #ifndef MYSQL_TYPE_JSON
 #define MYSQL_TYPE_JSON 245
@@ -106,6 +106,7 @@ int killqueries = 0;
 int lock_all_tables = 0;
 gboolean no_schemas = FALSE;
 gboolean dump_checksums = FALSE;
+gboolean dump_checksums_per_chunk = FALSE;
 gboolean no_locks = FALSE;
 gboolean less_locking = FALSE;
 gboolean no_backup_locks = FALSE;
@@ -139,6 +140,9 @@ static GOptionEntry start_dump_entries[] = {
      "Compress output files", NULL},
     {"table-checksums", 'M', 0, G_OPTION_ARG_NONE, &dump_checksums,
      "Dump table checksums with the data", NULL},
+    {"table-checksums-per-chunk", 0, 0, G_OPTION_ARG_NONE, &dump_checksums_per_chunk,
+     "Dump table checksums per chunk, using the chunks of --rows, so they are "
+     "computed in parallel and myloader can report the chunks that do not match", NULL},
     {"long-query-retries", 0, 0, G_OPTION_ARG_INT, &longquery_retries,
      "Retry checking for long queries, default 0 (do not retry)", NULL},
     {"long-query-retry-interval", 0, 0, G_OPTION_ARG_INT, &longquery_retry_interval,
@@ -531,10 +535,17 @@ void get_tables(MYSQL *conn, struct configuration *conf) {
   g_free(query);
 }
 
+static GAsyncQueue *progress_queue=NULL;
+
+// Jobs that no thread has taken yet, shown by the status of the control
+// socket
+static void append_dump_progress(GString *s){
+  g_string_append_printf(s, "queued_jobs: %d\n", g_async_queue_length(progress_queue));
+}
 
 void start_dump() {
   MYSQL *conn = create_main_connection();
-  struct configuration conf = {1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0};
+  struct configuration conf = {1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0};
   char *p;
   char *p2;
   char *p3;
@@ -549,6 +560,7 @@ void start_dump() {
   guint n;
   FILE *nufile = NULL;
   guint have_backup_locks = 0;
+  guint64 lock_ts = 0;
   GThread *disk_check_thread = NULL;
   GString *db_quoted_list=NULL;
   if (db){
@@ -604,6 +616,48 @@ void start_dump() {
     get_not_updated(conn, nufile);
   }
 
+  GThread **threads = g_new(GThread *, num_threads * (less_locking + 1));
+  struct thread_data *td =
+      g_new(struct thread_data, num_threads * (less_locking + 1));
+
+  /* The threads connect and set up their sessions before the lock is taken,
+     then wait in conf.start_snapshot to start their transactions */
+  conf.queue = g_async_queue_new();
+  conf.ready = g_async_queue_new();
+  conf.start_snapshot = g_async_queue_new();
+  for (n = 0; n < num_threads; n++) {
+    td[n].conf = &conf;
+    td[n].thread_id = n + 1;
+    td[n].queue = conf.queue;
+    td[n].ready = conf.ready;
+    td[n].less_locking_stage = FALSE;
+    threads[n] =
+        g_thread_create((GThreadFunc)working_thread, &td[n], TRUE, NULL);
+  }
+  /* The less locking threads do not need the lock at all, they only wait
+     for the jobs of the non-InnoDB tables, so they connect together with
+     the others */
+  if (less_locking) {
+    conf.queue_less_locking = g_async_queue_new();
+    conf.ready_less_locking = g_async_queue_new();
+    for (n = num_threads; n < num_threads * 2; n++) {
+      td[n].conf = &conf;
+      td[n].thread_id = n + 1;
+      td[n].queue = conf.queue_less_locking;
+      td[n].ready = conf.ready_less_locking;
+      td[n].less_locking_stage = TRUE;
+      threads[n] = g_thread_create((GThreadFunc)working_thread,
+                                   &td[n], TRUE, NULL);
+    }
+  }
+  for (n = 0; n < num_threads; n++)
+    g_async_queue_pop(conf.ready);
+  if (less_locking) {
+    for (n = 0; n < num_threads; n++)
+      g_async_queue_pop(conf.ready_less_locking);
+    g_async_queue_unref(conf.ready_less_locking);
+  }
+
   /* We check SHOW PROCESSLIST, and if there're queries
      larger than preset value, we terminate the process.
 
@@ -683,6 +737,7 @@ void start_dump() {
   }
 
   if (!no_locks && (detected_server != SERVER_TYPE_TIDB)) {
+    lock_ts = trace_begin();
     // Percona Server 8 removed LOCK BINLOG so backup locks is useless for
     // mydumper now and we need to fail back to FTWRL
     mysql_query(conn, "SELECT @@version_comment, @@version");
@@ -837,6 +892,8 @@ void start_dump() {
         errors++;
       }
     }
+    trace_end(lock_ts, "lock acquire", "lock", NULL, NULL, 0);
+    lock_ts = trace_begin();
   } else if (detected_server == SERVER_TYPE_TIDB) {
     g_message("Skipping locks because of TiDB");
     if (!tidb_snapshot) {
@@ -929,50 +986,33 @@ void start_dump() {
     stream_queue = g_async_queue_new();
     stream_thread = g_thread_create((GThreadFunc)process_stream, stream_queue, TRUE, NULL);
   }
-  GThread **threads = g_new(GThread *, num_threads * (less_locking + 1));
-  struct thread_data *td =
-      g_new(struct thread_data, num_threads * (less_locking + 1));
-
-  if (less_locking) {
-    conf.queue_less_locking = g_async_queue_new();
-    conf.ready_less_locking = g_async_queue_new();
-    for (n = num_threads; n < num_threads * 2; n++) {
-      td[n].conf = &conf;
-      td[n].thread_id = n + 1;
-      td[n].queue = conf.queue_less_locking;
-      td[n].ready = conf.ready_less_locking;
-      td[n].less_locking_stage = TRUE;
-      threads[n] = g_thread_create((GThreadFunc)working_thread,
-                                   &td[n], TRUE, NULL);
-      g_async_queue_pop(conf.ready_less_locking);
-    }
-    g_async_queue_unref(conf.ready_less_locking);
-  }
-
-  conf.queue = g_async_queue_new();
-  conf.ready = g_async_queue_new();
   conf.unlock_tables = g_async_queue_new();
   conf.ready_database_dump = g_async_queue_new();
-
-  for (n = 0; n < num_threads; n++) {
-    td[n].conf = &conf;
-    td[n].thread_id = n + 1;
-    td[n].queue = conf.queue;
-    td[n].ready = conf.ready;
-    td[n].less_locking_stage = FALSE;
-    threads[n] =
-        g_thread_create((GThreadFunc)working_thread, &td[n], TRUE, NULL);
+  progress_queue = conf.queue;
+  control_set_progress(append_dump_progress);
+
+  /* All the snapshots are started at once, so the lock is held for about
+     one round trip whatever the number of threads */
+  for (n = 0; n < num_threads; n++)
+    g_async_queue_push(conf.start_snapshot, GINT_TO_POINTER(1));
+  for (n = 0; n < num_threads; n++)
     g_async_queue_pop(conf.ready);
-  }
 
   g_async_queue_unref(conf.ready);
+  g_async_queue_unref(conf.start_snapshot);
 
   if (trx_consistency_only) {
     g_message("Transactions started, unlocking tables");
     mysql_query(conn, "UNLOCK TABLES /* trx-only */");
     if (have_backup_locks)
       mysql_query(conn, "UNLOCK BINLOG");
+    if (lock_ts > 0)
+      trace_end(lock_ts, "locked", "lock", NULL, NULL, 0);
   }
+  // The health checks only start once the tables are unlocked, so they do
+  // not add a connection while the lock is held
+  if (no_locks || trx_consistency_only)
+    start_server_health();
 
   if (db) {
     guint i=0;
@@ -1069,9 +1109,6 @@ void start_dump() {
   } else {
     for (iter = non_innodb_table; iter != NULL; iter = iter->next) {
       dbt = (struct db_table *)iter->data;
-      if (dump_checksums) {
-        create_job_to_dump_checksum(dbt, &conf);
-      }
       create_job_to_dump_table(conn, dbt, &conf, FALSE);
       g_atomic_int_inc(&non_innodb_table_counter);
     }
@@ -1082,9 +1119,6 @@ void start_dump() {
   innodb_tables = g_list_reverse(innodb_tables);
   for (iter = innodb_tables; iter != NULL; iter = iter->next) {
     dbt = (struct db_table *)iter->data;
-    if (dump_checksums) {
-      create_job_to_dump_checksum(dbt, &conf);
-    }
     create_job_to_dump_table(conn, dbt, &conf, TRUE);
   }
   g_list_free(innodb_tables);
@@ -1116,11 +1150,16 @@ void start_dump() {
   schema_post=NULL;
 
   if (!no_locks && !trx_consistency_only) {
+    guint64 ts = trace_begin();
     g_async_queue_pop(conf.unlock_tables);
+    trace_end(ts, "wait unlock tables", "lock", NULL, NULL, 0);
     g_message("Non-InnoDB dump complete, unlocking tables");
     mysql_query(conn, "UNLOCK TABLES /* FTWRL */");
     if (have_backup_locks)
       mysql_query(conn, "UNLOCK BINLOG");
+    if (lock_ts > 0)
+      trace_end(lock_ts, "locked", "lock", NULL, NULL, 0);
+    start_server_health();
   }
   // close main connection
   mysql_close(conn);
@@ -1141,6 +1180,8 @@ void start_dump() {
   for (n = 0; n < num_threads; n++) {
     g_thread_join(threads[n]);
   }
+  stop_server_health();
+  control_set_progress(NULL);
 
   // TODO: We need to create jobs for metadata.
   table_schemas = g_list_reverse(table_schemas);
@@ -1163,6 +1204,8 @@ void start_dump() {
   g_rename(p, p2);
   if (stream) {
     g_async_queue_push(stream_queue, g_strdup(p2));
+  }else{
+    write_manifest(dump_directory);
   }
   g_free(p);
   g_free(p2);
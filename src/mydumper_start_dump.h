@@ -41,6 +41,7 @@ struct configuration {
   GAsyncQueue *ready_database_dump;
   GAsyncQueue *unlock_tables;
   GAsyncQueue *pause_resume;
+  GAsyncQueue *start_snapshot;
   GMutex *mutex;
   int done;
 };
@@ -75,10 +76,24 @@ struct table_job {
   struct db_table *dbt;
 };
 
+// The chunks of a table checksum are dumped by different threads, the last
+// one to finish writes the checksum file
+struct table_checksum_chunks {
+  char *filename;
+  GMutex *mutex;
+  gchar *query;
+  guint count;
+  gchar **wheres;
+  gchar **results;
+  gint pending;
+};
+
 struct table_checksum_job {
   char *database;
   char *table;
   char *filename;
+  struct table_checksum_chunks *chunks;
+  guint nchunk;
 };
 
 struct tables_job {
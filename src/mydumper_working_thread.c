@@ -19,9 +19,6 @@
                     David Ducos, Percona (david dot ducos at percona dot com)
 */
 
-#define _LARGEFILE64_SOURCE
-#define _FILE_OFFSET_BITS 64
-
 #include <mysql.h>
 
 #if defined MARIADB_CLIENT_VERSION_STR && !defined MYSQL_SERVER_VERSION
@@ -60,6 +57,9 @@
 
 #include "tables_skiplist.h"
 #include "regex.h"
+#include "metrics.h"
+#include "trace.h"
+#include "control.h"
 
 #include "mydumper_start_dump.h"
 #include "mydumper_jobs.h"
@@ -67,10 +67,7 @@
 #include "mydumper_stream.h"
 #include "mydumper_database.h"
 #include "mydumper_working_thread.h"
-/* Some earlier versions of MySQL do not yet define MYSQL_TYPE_JSON */
-#ifndef MYSQL_TYPE_JSON
-#define MYSQL_TYPE_JSON 245
-#endif
+#include "mydumper_row.h"
 
 GMutex *init_mutex = NULL;
 /* Program options */
@@ -154,6 +151,7 @@ extern guint errors;
 guint statement_size = 1000000;
 guint chunk_filesize = 0;
 int build_empty_files = 0;
+gboolean chunk_checksums = FALSE;
 
 static GOptionEntry working_thread_entries[] = {
     {"events", 'E', 0, G_OPTION_ARG_NONE, &dump_events, "Dump events. By default, it do not dump events", NULL},
@@ -185,6 +183,10 @@ static GOptionEntry working_thread_entries[] = {
      NULL},
     {"build-empty-files", 'e', 0, G_OPTION_ARG_NONE, &build_empty_files,
      "Build dump files even if no data available from table", NULL},
+    {"chunk-checksums", 0, 0, G_OPTION_ARG_NONE, &chunk_checksums,
+     "Compute a checksum of the rows of each data file while dumping and "
+     "write it in the manifest, so myloader can verify every chunk",
+     NULL},
     { "where", 0, 0, G_OPTION_ARG_STRING, &where_option,
       "Dump only selected records.", NULL },
     {"trx-consistency-only", 0, 0, G_OPTION_ARG_NONE, &trx_consistency_only,
@@ -410,10 +412,13 @@ void thd_JOB_LOCK_DUMP_NON_INNODB(struct configuration *conf, struct thread_data
         g_string_printf(prev_database, "%s", tj->database);
       }
       *first = 1;
+      guint64 ts=trace_begin();
       if (mysql_query(td->thrconn, query->str)) {
         g_critical("Non Innodb lock tables fail: %s", mysql_error(td->thrconn));
         exit(EXIT_FAILURE);
       }
+      trace_end(ts, "lock tables", "lock", NULL, NULL, 0);
+      ts=trace_begin();
       if (g_atomic_int_dec_and_test(&non_innodb_table_counter) &&
           g_atomic_int_get(&non_innodb_done)) {
         g_async_queue_push(conf->unlock_tables, GINT_TO_POINTER(1));
@@ -426,6 +431,7 @@ void thd_JOB_LOCK_DUMP_NON_INNODB(struct configuration *conf, struct thread_data
         g_free(tj);
       }
       mysql_query(td->thrconn, "UNLOCK TABLES /* Non Innodb */");
+      trace_end(ts, "tables locked", "lock", NULL, NULL, 0);
       g_list_free(mj->table_job_list);
       g_free(mj);
       g_free(job);
@@ -437,13 +443,17 @@ void initialize_thread(struct thread_data *td){
             td->thread_id, mysql_thread_id(td->thrconn));
 }
 
-void initialize_consistent_snapshot(struct thread_data *td){
+// Session settings that do not need the lock, applied before it is taken
+void prepare_consistent_snapshot(struct thread_data *td){
   if ( sync_wait != -1 && mysql_query(td->thrconn, g_strdup_printf("SET SESSION WSREP_SYNC_WAIT = %d",sync_wait))){
     g_critical("Failed to set wsrep_sync_wait for the thread: %s",
                mysql_error(td->thrconn));
     exit(EXIT_FAILURE);
   }
   set_transaction_isolation_level_repeatable_read(td->thrconn);
+}
+
+void initialize_consistent_snapshot(struct thread_data *td){
   if (mysql_query(td->thrconn,
                   "START TRANSACTION /*!40108 WITH CONSISTENT SNAPSHOT */")) {
     g_critical("Failed to start consistent snapshot: %s", mysql_error(td->thrconn));
@@ -492,6 +502,8 @@ void *working_thread(struct thread_data *td) {
   g_mutex_unlock(init_mutex);
 
   initialize_thread(td);
+  metrics_set_thread(td->thread_id);
+  trace_set_thread(td->thread_id);
   execute_gstring(td->thrconn, set_session);
 
   // Initialize connection 
@@ -504,13 +516,19 @@ void *working_thread(struct thread_data *td) {
                  mysql_error(td->thrconn));
       exit(EXIT_FAILURE);
     }
-    initialize_consistent_snapshot(td);
-    check_connection_status(td);
+    prepare_consistent_snapshot(td);
   }
   if (set_names_str)
     mysql_query(td->thrconn, set_names_str);
 
   g_async_queue_push(td->ready, GINT_TO_POINTER(1));
+  // Connected, the transaction is started once the lock is held
+  if (!td->less_locking_stage){
+    g_async_queue_pop(conf->start_snapshot);
+    initialize_consistent_snapshot(td);
+    check_connection_status(td);
+    g_async_queue_push(td->ready, GINT_TO_POINTER(1));
+  }
   // Thread Ready to process jobs
  
   struct job *job = NULL;
@@ -521,6 +539,7 @@ void *working_thread(struct thread_data *td) {
   /* if less locking we need to wait until that threads finish
       progressively waking up these threads */
   if (!td->less_locking_stage && less_locking) {
+    guint64 ts=trace_begin();
     g_mutex_lock(ll_mutex);
 
     while (less_locking_threads >= td->thread_id) {
@@ -528,6 +547,7 @@ void *working_thread(struct thread_data *td) {
     }
 
     g_mutex_unlock(ll_mutex);
+    trace_end(ts, "wait less locking", "lock", NULL, NULL, 0);
   }
 
   GMutex *resume_mutex=NULL;
@@ -548,6 +568,12 @@ void *working_thread(struct thread_data *td) {
       continue;
     }
 
+    // The jobs of the non-InnoDB tables run while the tables are locked for
+    // all the threads, so they take no slot and are never paused or
+    // throttled, not to make the lock last longer
+    gboolean holds_lock=job->type == JOB_DUMP_NON_INNODB || job->type == JOB_LOCK_DUMP_NON_INNODB;
+    if (job->type != JOB_SHUTDOWN && !holds_lock)
+      control_job_begin();
     switch (job->type) {
     case JOB_LOCK_DUMP_NON_INNODB:
       thd_JOB_LOCK_DUMP_NON_INNODB(conf, td, job, &first, prev_database, prev_table);
@@ -604,6 +630,8 @@ void *working_thread(struct thread_data *td) {
       g_critical("Something very bad happened!");
       exit(EXIT_FAILURE);
     }
+    if (!holds_lock)
+      control_job_end();
   }
   if (td->thrconn)
     mysql_close(td->thrconn);
@@ -1036,6 +1064,24 @@ gboolean write_data(FILE *file, GString *data) {
   return TRUE;
 }
 
+// Compression happens inside the writes, so their time is accounted as
+// compression when the output is compressed. The bytes count toward
+// --max-throughput, which is only applied once the job ends, as sleeping
+// while the result set is open could make the server drop the connection.
+static gboolean write_data_with_metrics(FILE *file, GString *data, struct metrics_counters *mc) {
+  guint64 start=metrics_now();
+  gboolean r=write_data(file, data);
+  mc->ns[compress_output ? METRICS_COMPRESS : METRICS_WRITE]+=metrics_now() - start;
+  mc->bytes+=data->len;
+  control_count(data->len);
+  return r;
+}
+
+static guint64 get_file_size(const gchar *filename) {
+  struct stat st;
+  return g_stat(filename, &st) == 0 ? (guint64)st.st_size : 0;
+}
+
 /* Do actual data chunk reading/writing magic */
 guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * tj){
   // There are 2 possible options to chunk the files:
@@ -1046,6 +1092,11 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
   guint i;
   guint fn = 0;
   guint sub_part=0;
+  guint file_part=tj->nchunk, file_sub_part=0;
+  guint64 file_first_row=0;
+  guint64 file_checksum=0, row_checksum=0;
+  struct metrics_counters mc;
+  guint64 start=0, row_start=0, now=0;
   guint st_in_file = 0;
   guint num_fields = 0;
   guint64 num_rows = 0;
@@ -1066,6 +1117,10 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
 //  }
 
   gboolean has_generated_fields = tj->has_generated_fields;
+  // The checksum is computed over the values read from the server, which
+  // are not the ones written when they are anonymized, and myloader reads
+  // them back with SELECT * which would include the generated columns
+  gboolean do_checksum = chunk_checksums && !has_generated_fields && dbt->anonymized_function == NULL;
 
   /* Ghm, not sure if this should be statement_size - but default isn't too big
    * for now */
@@ -1088,6 +1143,8 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
       tj->where ? tj->where : "",  (tj->where && where_option ) ? "AND" : "", where_option ? where_option : "", tj->order_by ? "ORDER BY" : "",
       tj->order_by ? tj->order_by : "");
   g_string_free(select_fields, TRUE);
+  memset(&mc, 0, sizeof(mc));
+  start=metrics_now();
   if (mysql_query(conn, query) || !(result = mysql_use_result(conn))) {
     // ERROR 1146
     if (success_on_1146 && mysql_errno(conn) == 1146) {
@@ -1103,6 +1160,8 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
 
   num_fields = mysql_num_fields(result);
   MYSQL_FIELD *fields = mysql_fetch_fields(result);
+  row_start = metrics_now();
+  mc.ns[METRICS_QUERY] = row_start - start;
 
   MYSQL_ROW row;
 
@@ -1113,6 +1172,15 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
   while ((row = mysql_fetch_row(result))) {
     gulong *lengths = mysql_fetch_lengths(result);
     num_rows++;
+    if (metrics_enabled){
+      now = metrics_now();
+      mc.ns[METRICS_FETCH] += now - row_start;
+      row_start = now;
+    }
+    if (do_checksum){
+      row_checksum = checksum_row(row, lengths, num_fields);
+      file_checksum += row_checksum;
+    }
 
     if (!statement->len) {
 	    
@@ -1135,7 +1203,7 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
           g_string_printf(statement, "SET FOREIGN_KEY_CHECKS=0;\n");
         }
 
-        if (!write_data(file, statement)) {
+        if (!write_data_with_metrics(file, statement, &mc)) {
           g_critical("Could not write out data for %s.%s", tj->database, tj->table);
           goto cleanup;
         }
@@ -1159,7 +1227,7 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
 
           append_columns(statement,fields,num_fields);
           g_string_append(statement,");\n");
-	        if (!write_data(main_file, statement)) {
+	        if (!write_data_with_metrics(main_file, statement, &mc)) {
 		        g_critical("Could not write out data for %s.%s", tj->database, tj->table);
 		        goto cleanup;
   	      }else{
@@ -1189,93 +1257,58 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
       num_rows_st++;
     }
 
-    g_string_append(statement_row, lines_starting_by);
-    GList *f = dbt->anonymized_function;
-    gchar * (*fun_ptr)(gchar **) = &identity_function;
-    for (i = 0; i < num_fields; i++) {
-      if (f){
-      fun_ptr=f->data;
-      f=f->next;
-      }
-      if (load_data){
-        if (!row[i]) {
-//          g_string_append(statement_row,fields_enclosed_by);
-          g_string_append(statement_row, "\\N");
-//          g_string_append(statement_row,fields_enclosed_by);
-        }else if (fields[i].type != MYSQL_TYPE_LONG && fields[i].type != MYSQL_TYPE_LONGLONG  && fields[i].type != MYSQL_TYPE_INT24  && fields[i].type != MYSQL_TYPE_SHORT ){
-          g_string_append(statement_row,fields_enclosed_by);
-          g_string_set_size(escaped, lengths[i] * 2 + 1);
-          mysql_real_escape_string(conn, escaped->str, fun_ptr(&(row[i])), lengths[i]);
-          g_string_append(statement_row,escaped->str);
-          g_string_append(statement_row,fields_enclosed_by);
-        }else
-          g_string_append(statement_row,fun_ptr(&(row[i])));
-      }else{
-        /* Don't escape safe formats, saves some time */
-        if (!row[i]) {
-          g_string_append(statement_row, "NULL");
-        } else if (fields[i].flags & NUM_FLAG) {
-          g_string_append(statement_row, fun_ptr(&(row[i])));
-        } else {
-          /* We reuse buffers for string escaping, growing is expensive just at
-           * the beginning */
-          g_string_set_size(escaped, lengths[i] * 2 + 1);
-          mysql_real_escape_string(conn, escaped->str, fun_ptr(&(row[i])), lengths[i]);
-          if (fields[i].type == MYSQL_TYPE_JSON)
-            g_string_append(statement_row, "CONVERT(");
-          g_string_append_c(statement_row, '\"');
-          g_string_append(statement_row, escaped->str);
-          g_string_append_c(statement_row, '\"');
-          if (fields[i].type == MYSQL_TYPE_JSON)
-            g_string_append(statement_row, " USING UTF8MB4)");
-        }
+    write_row_into_string(conn, row, fields, lengths, num_fields, dbt->anonymized_function, escaped, statement_row);
+
+    /* INSERT statement is closed before over limit */
+    if (statement->len + statement_row->len + 1 > statement_size) {
+      if (num_rows_st == 0) {
+        g_string_append(statement, statement_row->str);
+        g_string_set_size(statement_row, 0);
+        g_warning("Row bigger than statement_size for %s.%s", tj->database,
+                  tj->table);
       }
-      if (i < num_fields - 1) {
-        g_string_append(statement_row, fields_terminated_by);
-      } else {
-        g_string_append_printf(statement_row,"%s", lines_terminated_by);
-
-        /* INSERT statement is closed before over limit */
-        if (statement->len + statement_row->len + 1 > statement_size) {
-          if (num_rows_st == 0) {
-            g_string_append(statement, statement_row->str);
-            g_string_set_size(statement_row, 0);
-            g_warning("Row bigger than statement_size for %s.%s", tj->database,
-                      tj->table);
-          }
-          g_string_append(statement, statement_terminated_by);
+      g_string_append(statement, statement_terminated_by);
 
-          if (!write_data(file, statement)) {
-            g_critical("Could not write out data for %s.%s", tj->database, tj->table);
-            goto cleanup;
-          } else {
-            st_in_file++;
-            if (chunk_filesize &&
-                st_in_file * (guint)ceil((float)statement_size / 1024 / 1024) >
-                    chunk_filesize) {
-              if (tj->where == NULL){
-                fn++;
-              }else{
-                sub_part++;
-              }
-              m_close(file);
-              if (stream) g_async_queue_push(stream_queue, g_strdup(fcfile));
-              g_free(fcfile);
-              fcfile = build_data_filename(dbt->database->filename, dbt->table_filename, fn, sub_part);
-              file = m_open(fcfile,"w");
-              st_in_file = 0;
-            }
+      if (!write_data_with_metrics(file, statement, &mc)) {
+        g_critical("Could not write out data for %s.%s", tj->database, tj->table);
+        goto cleanup;
+      } else {
+        st_in_file++;
+        if (chunk_filesize &&
+            st_in_file * (guint)ceil((float)statement_size / 1024 / 1024) >
+                chunk_filesize) {
+          if (tj->where == NULL){
+            fn++;
+          }else{
+            sub_part++;
           }
-          g_string_set_size(statement, 0);
-        } else {
-          if (num_rows_st && ! load_data)
-            g_string_append_c(statement, ',');
-          g_string_append(statement, statement_row->str);
-          num_rows_st++;
-          g_string_set_size(statement_row, 0);
+          m_close(file);
+          if (compress_output) mc.compressed_bytes += get_file_size(fcfile);
+          if (stream) g_async_queue_push(stream_queue, g_strdup(fcfile));
+          // The current row is not in the file yet if it is still in statement_row
+          register_data_file(fcfile, dbt->database->filename, dbt->table_filename, file_part, file_sub_part,
+                             num_rows - file_first_row - (statement_row->len > 0 ? 1 : 0), tj->where,
+                             do_checksum, file_checksum - (statement_row->len > 0 ? row_checksum : 0));
+          file_first_row=num_rows - (statement_row->len > 0 ? 1 : 0);
+          file_checksum=statement_row->len > 0 ? row_checksum : 0;
+          file_part=fn;
+          file_sub_part=sub_part;
+          g_free(fcfile);
+          fcfile = build_data_filename(dbt->database->filename, dbt->table_filename, fn, sub_part);
+          file = m_open(fcfile,"w");
+          st_in_file = 0;
         }
       }
+      g_string_set_size(statement, 0);
+    } else {
+      if (num_rows_st && ! load_data)
+        g_string_append_c(statement, ',');
+      g_string_append(statement, statement_row->str);
+      num_rows_st++;
+      g_string_set_size(statement_row, 0);
     }
+    if (metrics_enabled)
+      row_start = metrics_now();
   }
   if (mysql_errno(conn)) {
     g_critical("Could not read data from %s.%s: %s", tj->database, tj->table,
@@ -1296,7 +1329,7 @@ guint64 write_table_data_into_file(MYSQL *conn, FILE *file, struct table_job * t
 
   if (statement->len > 0) {
     g_string_append(statement, statement_terminated_by);
-    if (!write_data(file, statement)) {
+    if (!write_data_with_metrics(file, statement, &mc)) {
       g_critical(
           "Could not write out closing newline for %s.%s, now this is sad!",
           tj->database, tj->table);
@@ -1325,16 +1358,30 @@ cleanup:
     if (remove(fcfile)) {
       g_warning("Failed to remove empty file : %s\n", fcfile);
     }
-  } else if (chunk_filesize) {
-    if (stream) g_async_queue_push(stream_queue, g_strdup(fcfile));
-  }else{
-    if (stream) g_async_queue_push(stream_queue, g_strdup(tj->filename));
+  } else {
+    if (compress_output) mc.compressed_bytes += get_file_size(fcfile);
+    register_data_file(fcfile, dbt->database->filename, dbt->table_filename, file_part, file_sub_part,
+                       num_rows - file_first_row, tj->where, do_checksum, file_checksum);
+    if (chunk_filesize) {
+      if (stream) g_async_queue_push(stream_queue, g_strdup(fcfile));
+    }else{
+      if (stream) g_async_queue_push(stream_queue, g_strdup(tj->filename));
+    }
   }
 
   g_mutex_lock(dbt->rows_lock);
   dbt->rows+=num_rows;
   g_mutex_unlock(dbt->rows_lock);
 
+  // Formatting is what is left once the other phases are taken out
+  now = metrics_now() - start;
+  for (i = 0; i < METRICS_TIMERS; i++)
+    now = now > mc.ns[i] ? now - mc.ns[i] : 0;
+  mc.ns[METRICS_FORMAT] = now;
+  mc.rows = num_rows;
+  trace_end(start, "dump", "data", tj->database, tj->table, mc.bytes);
+  metrics_flush(tj->database, tj->table, &mc);
+
   g_free(fcfile);
 
   return num_rows;
@@ -17,9 +17,6 @@
 
 */
 
-#define _LARGEFILE64_SOURCE
-#define _FILE_OFFSET_BITS 64
-
 #include <mysql.h>
 
 #if defined MARIADB_CLIENT_VERSION_STR && !defined MYSQL_SERVER_VERSION
@@ -57,6 +54,15 @@
 #include "myloader_jobs_manager.h"
 #include "myloader_directory.h"
 #include "myloader_restore.h"
+#include "myloader_prefetch.h"
+#include "myloader_target_health.h"
+#include "myloader_index.h"
+#include "myloader_chunk_checksum.h"
+#include "metrics.h"
+#include "trace.h"
+#include "control.h"
+#include "myloader_prepared.h"
+#include "myloader_load_data.h"
 
 guint commit_count = 1000;
 gchar *input_directory = NULL;
@@ -76,11 +82,14 @@ gchar *purge_mode_str=NULL;
 gchar *set_names_str=NULL;
 guint errors = 0;
 guint max_threads_per_table=4;
+guint split_data_file_size=256;
 //unsigned long long int total_data_sql_files = 0;
 //unsigned long long int progress = 0;
 //GHashTable *db_hash=NULL;
 extern GHashTable *db_hash;
 extern gboolean shutdown_triggered;
+extern guint health_check_interval;
+extern gboolean verify_chunk_checksums;
 
 const char DIRECTORY[] = "import";
 
@@ -114,6 +123,8 @@ static GOptionEntry entries[] = {
      "Split the INSERT statement into this many rows.", NULL},
     {"max-threads-per-table", 0, 0, G_OPTION_ARG_INT, &max_threads_per_table,
      "Maximum number of threads per table to use, default 4", NULL},
+    {"split-data-file-size", 0, 0, G_OPTION_ARG_INT, &split_data_file_size,
+     "Uncompressed data files bigger than this size in MB are restored in parallel by up to --max-threads-per-table threads. 0 disables it, default 256", NULL},
     {"skip-triggers", 0, 0, G_OPTION_ARG_NONE, &skip_triggers, "Do not import triggers. By default, it imports triggers",
      NULL},
     {"skip-post", 0, 0, G_OPTION_ARG_NONE, &skip_post,
@@ -149,9 +160,9 @@ void create_database(struct thread_data *td, gchar *database) {
                                             directory, database, compress_extension);
 
   if (g_file_test(filepath, G_FILE_TEST_EXISTS)) {
-    restore_data_from_file(td, database, NULL, filename, TRUE);
+    restore_data_from_file(td, database, NULL, filename, TRUE, NULL);
   } else if (g_file_test(filepathgz, G_FILE_TEST_EXISTS)) {
-    restore_data_from_file(td, database, NULL, filenamegz, TRUE);
+    restore_data_from_file(td, database, NULL, filenamegz, TRUE, NULL);
   } else {
     query = g_strdup_printf("CREATE DATABASE IF NOT EXISTS `%s`", database);
     if (mysql_query(td->thrconn, query)){
@@ -185,6 +196,15 @@ int main(int argc, char *argv[]) {
   load_connection_entries(main_group);
   load_regex_entries(main_group);
   load_restore_entries(main_group);
+  load_prefetch_entries(main_group);
+  load_index_entries(main_group);
+  load_chunk_checksum_entries(main_group);
+  load_prepared_entries(main_group);
+  load_load_data_entries(main_group);
+  load_metrics_entries(main_group);
+  load_trace_entries(main_group);
+  load_control_entries(main_group);
+  load_target_health_entries(main_group);
   g_option_context_set_main_group(context, main_group);
   gchar ** tmpargv=g_strdupv(argv);
   int tmpargc=argc;
@@ -222,6 +242,8 @@ int main(int argc, char *argv[]) {
   } else 
     set_names_str=g_strdup("/*!40101 SET NAMES binary*/");
   initialize_job(purge_mode_str);
+  if (verify_chunk_checksums && stream)
+    g_warning("--verify-chunk-checksums is not supported in stream mode, no chunk is going to be verified");
 
   pwd=g_str_has_prefix(input_directory,"/")?g_strdup(""):g_get_current_dir();
   if (!input_directory) {
@@ -258,6 +280,9 @@ int main(int argc, char *argv[]) {
   initialize_process(&conf);
   initialize_common();
   initialize_regex();
+  initialize_metrics("myloader");
+  initialize_trace();
+  initialize_control("myloader", num_threads, health_check_interval > 0);
 
   GError *serror;
   GThread *sthread =
@@ -313,6 +338,12 @@ int main(int argc, char *argv[]) {
   t.conf = &conf;
   t.thrconn = conn;
   t.current_database=NULL;
+  t.dbt=NULL;
+  t.transaction_bytes=0;
+  t.restored_bytes=0;
+  t.metrics_table=NULL;
+  t.pipeline=NULL;
+  memset(&(t.metrics), 0, sizeof(struct metrics_counters));
 
   if (tables_list)
     tables = g_strsplit(tables_list, ",", 0);
@@ -323,11 +354,15 @@ int main(int argc, char *argv[]) {
     create_database(&t, db);
   }
 
+  initialize_prefetch();
+
   if (stream){
     initialize_stream(&conf);
   }
 
   initialize_loader_threads(&conf);
+  start_target_health();
+  initialize_index_threads(&conf);
   
   if (stream){
     wait_stream_to_finish();
@@ -336,6 +371,8 @@ int main(int argc, char *argv[]) {
   }
 
   wait_loader_threads_to_finish();
+  stop_target_health();
+  finish_prefetch();
 
   g_async_queue_unref(conf.ready);
 
@@ -345,6 +382,9 @@ int main(int argc, char *argv[]) {
   g_async_queue_unref(conf.data_queue);
 
   checksum_databases(&t);
+  finish_metrics();
+  finish_trace();
+  finish_control();
 
   if (stream && no_delete == FALSE && input_directory == NULL){
     // remove metadata files
@@ -19,12 +19,19 @@
 
 #ifndef _src_myloader_h
 #define _src_myloader_h
+#include "metrics.h"
 
 struct thread_data {
   struct configuration *conf;
   MYSQL *thrconn;
   gchar *current_database;
   guint thread_id;
+  struct db_table *dbt;
+  guint64 transaction_bytes;
+  guint64 restored_bytes;
+  struct metrics_counters metrics;
+  struct table_metrics *metrics_table;
+  struct statement_pipeline *pipeline;
 };
 
 struct configuration {
@@ -44,26 +51,39 @@ struct configuration {
   int done;
 };
 
+// NOT_FOUND means that there is no CREATE TABLE job for the table
+enum schema_status { NOT_FOUND, NOT_CREATED, CREATED };
+
 struct db_table {
   char *database;
   char *real_database;
   char *table;
   char *real_table;
   guint64 rows;
-  GAsyncQueue * queue;
+  guint64 data_size;
+  guint64 work;
+  GPtrArray * chunk_jobs;
+  GList * chunk_ranges;
+  gboolean chunks_started;
+  guint commit_size;
+  guint min_commit_size;
+  guint max_commit_size;
   GList * restore_job_list;
+  GHashTable * chunk_checksums;
   guint current_threads;
   guint max_threads;
+  gboolean in_ready_table_queue;
   GMutex *mutex;
   GString *indexes;
   GString *constraints;
   guint count;
-  gboolean schema_created;
+  enum schema_status schema_state;
+  GCond *schema_cond;
   GDateTime * start_time;
   GDateTime * start_index_time;
   GDateTime * finish_time;
 };
 
-enum file_type { INIT, SCHEMA_CREATE, SCHEMA_TABLE, DATA, SCHEMA_VIEW, SCHEMA_TRIGGER, SCHEMA_POST, CHECKSUM, METADATA_TABLE, METADATA_GLOBAL, RESUME, IGNORED, LOAD_DATA, SHUTDOWN};
+enum file_type { INIT, SCHEMA_CREATE, SCHEMA_TABLE, DATA, SCHEMA_VIEW, SCHEMA_TRIGGER, SCHEMA_POST, CHECKSUM, METADATA_TABLE, METADATA_GLOBAL, RESUME, IGNORED, LOAD_DATA, SHUTDOWN, MANIFEST};
 
 #endif
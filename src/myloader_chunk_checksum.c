@@ -0,0 +1,276 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "myloader.h"
+#include "myloader_common.h"
+#include "myloader_control_job.h"
+#include "myloader_chunk_checksum.h"
+#include "trace.h"
+
+extern guint errors;
+extern gboolean stream;
+extern gchar *directory;
+
+gboolean verify_chunk_checksums = FALSE;
+gboolean skip_tz = FALSE;
+
+static GList *server_chunk_checksums = NULL;
+
+static GOptionEntry chunk_checksum_entries[] = {
+    {"verify-chunk-checksums", 0, 0, G_OPTION_ARG_NONE, &verify_chunk_checksums,
+     "Verify the checksums of the chunks written by mydumper --chunk-checksums once the data has been loaded. "
+     "The rows are compared as text, so a target with a different version, character set or float formatting than the source can report mismatches. "
+     "Not supported in stream mode or with --resume", NULL},
+    {"skip-tz-utc", 0, 0, G_OPTION_ARG_NONE, &skip_tz,
+     "Verify the chunk checksums in the time zone of the session instead of UTC, as mydumper does with --skip-tz-utc", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_chunk_checksum_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, chunk_checksum_entries);
+}
+
+// The files of a chunk that was split by size share its WHERE, their
+// checksums are added up as they are computed over the rows of the chunk.
+// It is called while the directory is processed, before the loader threads
+// start loading the data.
+void register_chunk_checksum(struct db_table *dbt, const gchar *filename, const gchar *where, guint64 rows, guint64 checksum){
+  if (!verify_chunk_checksums || stream)
+    return;
+  if (dbt->chunk_checksums == NULL)
+    dbt->chunk_checksums=g_hash_table_new ( g_str_hash, g_str_equal );
+  struct chunk_checksum *cc=g_hash_table_lookup(dbt->chunk_checksums, where);
+  if (cc == NULL){
+    cc=g_new(struct chunk_checksum, 1);
+    cc->dbt=dbt;
+    cc->where=g_strdup(where);
+    cc->filenames=g_string_new(filename);
+    cc->rows=0;
+    cc->expected=0;
+    cc->server_checksum=NULL;
+    g_hash_table_insert(dbt->chunk_checksums, cc->where, cc);
+  }else{
+    g_string_append_printf(cc->filenames, ", %s", filename);
+  }
+  cc->rows+=rows;
+  cc->expected+=checksum;
+}
+
+// TIMESTAMP columns need to be read in the time zone that mydumper used
+static void set_checksum_time_zone(MYSQL *conn){
+  if (!skip_tz)
+    mysql_query(conn, "/*!40103 SET TIME_ZONE='+00:00' */");
+}
+
+// Returns the lines of a checksum file written by mydumper
+// --table-checksums-per-chunk, or NULL if it is a whole table checksum
+static gchar **read_chunk_checksum_file(const gchar *filename){
+  gchar *path=g_build_filename(directory, filename, NULL);
+  gchar *content=NULL;
+  gchar **lines=NULL;
+  if (!g_file_get_contents(path, &content, NULL, NULL)){
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+  if (g_str_has_prefix(content, "# mydumper chunk checksums 1\n"))
+    lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  return lines;
+}
+
+static void compare_server_chunk_checksum(MYSQL *conn, gchar *database, gchar *table, const gchar *filename,
+                                          gchar *query, const gchar *where, const gchar *expected){
+  int errn=0;
+  gchar *checksum=checksum_chunk(conn, query, where, &errn);
+  if (checksum == NULL){
+    errors++;
+    return;
+  }
+  if (strcmp(checksum, expected)){
+    g_warning("Checksum mismatch found for `%s`.`%s` in %s%s%s. Got '%s', expecting '%s'", database, table, filename,
+              *where != '\0' ? " WHERE " : "", where, checksum, expected);
+    errors++;
+  }else{
+    g_debug("Chunk checksum confirmed for `%s`.`%s`%s%s", database, table, *where != '\0' ? " WHERE " : "", where);
+  }
+  g_free(checksum);
+}
+
+// Verifies the chunks of a table one after the other. It is used when the
+// chunks could not be verified by the loader threads. Returns FALSE when
+// the file is a whole table checksum.
+gboolean verify_chunk_checksum_file(const gchar *filename, MYSQL *conn, gchar *database, gchar *table){
+  gchar **lines=read_chunk_checksum_file(filename);
+  gchar **fields=NULL;
+  guint i=0, count=0;
+  int errn=0;
+  if (lines == NULL)
+    return FALSE;
+  set_checksum_time_zone(conn);
+  gchar *query=build_chunk_checksum_query(conn, database, table, &errn);
+  if (query == NULL){
+    errors++;
+    g_strfreev(lines);
+    return TRUE;
+  }
+  for (i = 1; lines[i] != NULL; i++){
+    fields=g_strsplit(lines[i], "\t", 2);
+    if (g_strv_length(fields) == 2 && *fields[0] != '\0'){
+      gchar *where=g_strcompress(fields[1]);
+      compare_server_chunk_checksum(conn, database, table, filename, query, where, fields[0]);
+      g_free(where);
+      count++;
+    }
+    g_strfreev(fields);
+  }
+  g_message("Checksum of %u chunks verified for `%s`.`%s`", count, database, table);
+  g_free(query);
+  g_strfreev(lines);
+  return TRUE;
+}
+
+// Takes the chunk checksum files out of the checksum list, their chunks
+// are going to be verified by the loader threads
+static void register_server_chunk_checksums(struct configuration *conf){
+  GList *e=conf->checksum_list, *next=NULL;
+  gchar **lines=NULL, **fields=NULL;
+  gchar *database=NULL, *table=NULL, *lkey=NULL;
+  guint i=0;
+  while (e != NULL){
+    next=e->next;
+    database=NULL;
+    table=NULL;
+    get_database_table_from_file(e->data, "-checksum", &database, &table);
+    lkey=g_strdup_printf("%s_%s", database, table);
+    struct db_table *dbt=g_hash_table_lookup(conf->table_hash, lkey);
+    g_free(lkey);
+    g_free(database);
+    g_free(table);
+    if (dbt != NULL && (lines=read_chunk_checksum_file(e->data)) != NULL){
+      for (i = 1; lines[i] != NULL; i++){
+        fields=g_strsplit(lines[i], "\t", 2);
+        // Chunks that failed on the source have no checksum
+        if (g_strv_length(fields) == 2 && *fields[0] != '\0'){
+          struct chunk_checksum *cc=g_new0(struct chunk_checksum, 1);
+          cc->dbt=dbt;
+          cc->where=g_strcompress(fields[1]);
+          cc->filenames=g_string_new(e->data);
+          cc->server_checksum=g_strdup(fields[0]);
+          server_chunk_checksums=g_list_prepend(server_chunk_checksums, cc);
+        }
+        g_strfreev(fields);
+      }
+      g_strfreev(lines);
+      g_free(e->data);
+      conf->checksum_list=g_list_delete_link(conf->checksum_list, e);
+    }
+    e=next;
+  }
+}
+
+// Pushes one job per chunk to the data queue, so every loader thread takes
+// part in the verification
+guint enqueue_chunk_checksums(struct configuration *conf){
+  GList *t=NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint n=0;
+  register_server_chunk_checksums(conf);
+  server_chunk_checksums=g_list_reverse(server_chunk_checksums);
+  for (t = server_chunk_checksums; t != NULL; t = t->next){
+    g_async_queue_push(conf->data_queue, new_job(JOB_VERIFY_CHECKSUM, t->data, NULL));
+    n++;
+  }
+  for (t = conf->table_list; t != NULL; t = t->next){
+    struct db_table *dbt=t->data;
+    if (dbt->chunk_checksums == NULL)
+      continue;
+    g_hash_table_iter_init(&iter, dbt->chunk_checksums);
+    while (g_hash_table_iter_next(&iter, &key, &value)){
+      g_async_queue_push(conf->data_queue, new_job(JOB_VERIFY_CHECKSUM, value, NULL));
+      n++;
+    }
+  }
+  if (n > 0)
+    g_message("Verifying %u chunk checksums", n);
+  return n;
+}
+
+// Chunks with a server checksum are checksummed again on the target with
+// the query that mydumper used. The others are read back from the target
+// with the same WHERE that mydumper used and their checksum is computed the
+// same way. The values are compared as
+// text, so TIMESTAMP columns are read in the time zone of the dump.
+void verify_chunk_checksum(struct thread_data *td, struct chunk_checksum *cc){
+  struct db_table *dbt=cc->dbt;
+  MYSQL_RES *result=NULL;
+  MYSQL_ROW row;
+  guint64 checksum=0, rows=0;
+  guint num_fields=0;
+  int errn=0;
+  gchar *query=NULL;
+  guint64 ts=trace_begin();
+  set_checksum_time_zone(td->thrconn);
+  if (cc->server_checksum != NULL){
+    query=build_chunk_checksum_query(td->thrconn, dbt->real_database, dbt->real_table, &errn);
+    if (query == NULL){
+      errors++;
+      return;
+    }
+    compare_server_chunk_checksum(td->thrconn, dbt->real_database, dbt->real_table, cc->filenames->str,
+                                  query, cc->where, cc->server_checksum);
+    g_free(query);
+    trace_end(ts, "checksum", "checksum", dbt->real_database, dbt->real_table, 0);
+    return;
+  }
+  query=g_strdup_printf("SELECT * FROM `%s`.`%s` %s %s", dbt->real_database, dbt->real_table,
+                               *cc->where != '\0' ? "WHERE" : "", cc->where);
+  if (mysql_query(td->thrconn, query) || !(result = mysql_use_result(td->thrconn))){
+    g_critical("Error verifying the checksum of `%s`.`%s` (%s): %s", dbt->real_database, dbt->real_table,
+               cc->filenames->str, mysql_error(td->thrconn));
+    errors++;
+    g_free(query);
+    return;
+  }
+  g_free(query);
+  num_fields=mysql_num_fields(result);
+  while ((row = mysql_fetch_row(result))){
+    checksum+=checksum_row(row, mysql_fetch_lengths(result), num_fields);
+    rows++;
+  }
+  if (mysql_errno(td->thrconn)){
+    g_critical("Error verifying the checksum of `%s`.`%s` (%s): %s", dbt->real_database, dbt->real_table,
+               cc->filenames->str, mysql_error(td->thrconn));
+    errors++;
+  }else if (checksum != cc->expected || rows != cc->rows){
+    g_warning("Chunk checksum mismatch found for `%s`.`%s` in %s%s%s. Got %016llx over %llu rows, expecting %016llx over %llu rows",
+              dbt->real_database, dbt->real_table, cc->filenames->str,
+              *cc->where != '\0' ? " WHERE " : "", cc->where,
+              (unsigned long long)checksum, (unsigned long long)rows,
+              (unsigned long long)cc->expected, (unsigned long long)cc->rows);
+    errors++;
+  }else{
+    g_debug("Chunk checksum confirmed for `%s`.`%s` in %s", dbt->real_database, dbt->real_table, cc->filenames->str);
+  }
+  mysql_free_result(result);
+  trace_end(ts, "checksum", "checksum", dbt->real_database, dbt->real_table, 0);
+}
@@ -0,0 +1,36 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_chunk_checksum_h
+#define _src_myloader_chunk_checksum_h
+#include "myloader.h"
+
+struct chunk_checksum {
+  struct db_table *dbt;
+  gchar *where;
+  GString *filenames;
+  guint64 rows;
+  guint64 expected;
+  gchar *server_checksum;
+};
+
+void load_chunk_checksum_entries(GOptionGroup *main_group);
+void register_chunk_checksum(struct db_table *dbt, const gchar *filename, const gchar *where, guint64 rows, guint64 checksum);
+gboolean verify_chunk_checksum_file(const gchar *filename, MYSQL *conn, gchar *database, gchar *table);
+guint enqueue_chunk_checksums(struct configuration *conf);
+void verify_chunk_checksum(struct thread_data *td, struct chunk_checksum *cc);
+#endif
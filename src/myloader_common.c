@@ -30,6 +30,7 @@
 #include "myloader_process.h"
 #include "myloader_restore_job.h"
 #include "myloader_control_job.h"
+#include "myloader_chunk_checksum.h"
 
 #include "connection.h"
 #include "tables_skiplist.h"
@@ -134,6 +135,8 @@ enum file_type get_file_type (const char * filename){
     return METADATA_TABLE;
   } else if ( strcmp(filename, "metadata") == 0 ){
     return METADATA_GLOBAL;
+  } else if ( strcmp(filename, "manifest") == 0 ){
+    return MANIFEST;
   } else if ( strcmp(filename, "resume") == 0 ){
     if (!resume){
       g_critical("resume file found, but no --resume option passed. Use --resume or remove it and restart process if you consider that it will be safe.");
@@ -161,38 +164,6 @@ enum file_type get_file_type (const char * filename){
 }
 
 
-gboolean read_data(FILE *file, gboolean is_compressed, GString *data,
-                   gboolean *eof, guint *line) {
-  char buffer[256];
-
-  do {
-    if (!is_compressed) {
-      if (fgets(buffer, 256, file) == NULL) {
-        if (feof(file)) {
-          *eof = TRUE;
-          buffer[0] = '\0';
-        } else {
-          return FALSE;
-        }
-      }
-    } else {
-      if (!gzgets((gzFile)file, buffer, 256)) {
-        if (gzeof((gzFile)file)) {
-          *eof = TRUE;
-          buffer[0] = '\0';
-        } else {
-          return FALSE;
-        }
-      }
-    }
-    g_string_append(data, buffer);
-    if (strlen(buffer) != 256)
-      (*line)++;
-  } while ((buffer[strlen(buffer)] != '\0') && *eof == FALSE);
-
-  return TRUE;
-}
-
 void get_database_table_from_file(const gchar *filename,const char *sufix,gchar **database,gchar **table){
   gchar **split_filename = g_strsplit(filename, sufix, 0);
   gchar **split = g_strsplit(split_filename[0],".",0);
@@ -271,14 +242,34 @@ int process_create_table_statement (gchar * statement, GString *create_table_sta
   return flag;
 }
 
+// The work of a table is the amount of SQL that needs to be executed to load
+// it, plus the deferred index builds, which are estimated as a quarter of
+// the data per index. When the size of the data files is unknown, the rows
+// from the .metadata file are used instead.
+void estimate_table_work(struct db_table *dbt){
+  guint64 index_count=0;
+  gchar *from=NULL;
+  if (dbt->indexes != NULL){
+    from=dbt->indexes->str;
+    while ((from=g_strstr_len(from, -1, "\n ADD")) != NULL){
+      index_count++;
+      from++;
+    }
+  }
+  guint64 base= dbt->data_size > 0 ? dbt->data_size : dbt->rows;
+  dbt->work= base + base * index_count / 4;
+}
+
+// Tables with more work are sorted first, so that the longest tables start
+// first and the short ones fill the gaps at the end.
 gint compare_dbt(gconstpointer a, gconstpointer b, gpointer table_hash){
-  gchar *a_key=g_strdup_printf("%s_%s",((struct db_table *)a)->database,((struct db_table *)a)->table);
-  gchar *b_key=g_strdup_printf("%s_%s",((struct db_table *)b)->database,((struct db_table *)b)->table);
-  struct db_table * a_val=g_hash_table_lookup(table_hash,a_key);
-  struct db_table * b_val=g_hash_table_lookup(table_hash,b_key);
-  g_free(a_key);
-  g_free(b_key);
-  return a_val->rows < b_val->rows;
+  (void) table_hash;
+  const struct db_table *a_val=a, *b_val=b;
+  if (a_val->work != b_val->work)
+    return a_val->work < b_val->work ? 1 : -1;
+  if (a_val->rows != b_val->rows)
+    return a_val->rows < b_val->rows ? 1 : -1;
+  return 0;
 }
 
 void refresh_table_list(struct configuration *conf){
@@ -288,6 +279,7 @@ void refresh_table_list(struct configuration *conf){
   g_hash_table_iter_init ( &iter, conf->table_hash );
   struct db_table *dbt=NULL;
   while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
+    estimate_table_work(dbt);
     table_list=g_list_insert_sorted_with_data (table_list,dbt,&compare_dbt,conf->table_hash);
   }
   g_list_free(conf->table_list);
@@ -312,6 +304,8 @@ void checksum_table_filename(const gchar *filename, MYSQL *conn) {
   get_database_table_from_file(filename,"-checksum",&database,&table);
   gchar *real_database=db_hash_lookup(database);
   gchar *real_table=g_hash_table_lookup(tbl_hash,table);
+  if (verify_chunk_checksum_file(filename, conn, db ? db : real_database, real_table))
+    return;
   void *infile;
   char checksum[256];
   int errn=0;
@@ -20,13 +20,15 @@
 #define IS_INNODB_TABLE 2
 #define INCLUDE_CONSTRAINT 4
 #define IS_ALTER_TABLE_PRESENT 8
+// Used to estimate the amount of SQL in a compressed data file
+#define COMPRESSION_RATIO_ESTIMATE 4
 
 #include "myloader.h"
+#include "myloader_statement.h"
 
 guint execute_use(struct thread_data *td, const gchar * msg);
 void execute_use_if_needs_to(struct thread_data *td, gchar *database, const gchar * msg);
 enum file_type get_file_type (const char * filename);
-gboolean read_data(FILE *file, gboolean is_compressed, GString *data, gboolean *eof, guint *line);
 void db_hash_insert(gchar *k, gchar *v);
 //struct restore_job * new_restore_job( char * filename, char * database, struct db_table * dbt, GString * statement, guint part, guint sub_part, enum restore_job_type type, const char *object);
 char * db_hash_lookup(gchar *database);
@@ -36,6 +38,7 @@ void get_database_table_from_file(const gchar *filename,const char *sufix,gchar
 int process_create_table_statement (gchar * statement, GString *create_table_statement, GString *alter_table_statement, GString *alter_table_constraint_statement, struct db_table *dbt);
 void finish_alter_table(GString * alter_table_statement);
 void initialize_common();
+void estimate_table_work(struct db_table *dbt);
 gint compare_dbt(gconstpointer a, gconstpointer b, gpointer table_hash);
 void refresh_table_list(struct configuration *conf);
 void checksum_databases(struct thread_data *td);
@@ -17,6 +17,8 @@
 #include <glib.h>
 #include "myloader_control_job.h"
 #include "myloader_restore_job.h"
+#include "myloader_chunk_checksum.h"
+#include "control.h"
 
 struct control_job * new_job (enum control_job_type type, void *job_data, char *use_database) {
   struct control_job *j = g_new0(struct control_job, 1);
@@ -27,6 +29,9 @@ struct control_job * new_job (enum control_job_type type, void *job_data, char *
       j->data.queue = (GAsyncQueue *)job_data;
     case JOB_SHUTDOWN:
       break;
+    case JOB_VERIFY_CHECKSUM:
+      j->data.chunk_checksum = (struct chunk_checksum *)job_data;
+      break;
     default:
       j->data.restore_job = (struct restore_job *)job_data;
   }
@@ -45,6 +50,11 @@ gboolean process_job(struct thread_data *td, struct control_job *job){
 //      GAsyncQueue *queue=job->data.queue;
       g_async_queue_pop(job->data.queue);
       break;
+    case JOB_VERIFY_CHECKSUM:
+      control_job_begin();
+      verify_chunk_checksum(td, job->data.chunk_checksum);
+      control_job_end();
+      break;
     case JOB_SHUTDOWN:
 //      g_message("Thread %d shutting down", td->thread_id);
       g_free(job);
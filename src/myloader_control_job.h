@@ -20,12 +20,13 @@
 
 #include "myloader.h"
 
-enum control_job_type { JOB_RESTORE, JOB_WAIT, JOB_SHUTDOWN };
+enum control_job_type { JOB_RESTORE, JOB_WAIT, JOB_SHUTDOWN, JOB_VERIFY_CHECKSUM };
 
 
 union control_job_data {
   struct restore_job *restore_job;
   GAsyncQueue *queue;
+  struct chunk_checksum *chunk_checksum;
 };
 
 struct control_job {
@@ -35,6 +35,9 @@
 #include "myloader_restore.h"
 #include "myloader_restore_job.h"
 #include "myloader_control_job.h"
+#include "myloader_prefetch.h"
+#include "myloader_index.h"
+#include "myloader_chunk_checksum.h"
 
 extern guint num_threads;
 extern gboolean innodb_optimize_keys;
@@ -44,6 +47,9 @@ extern gboolean skip_post;
 extern gchar *source_db;
 extern gboolean skip_triggers;
 extern gboolean no_data;
+extern gboolean resume;
+extern guint commit_latency_target;
+extern gboolean verify_chunk_checksums;
 
 gint compare_by_time(gconstpointer a, gconstpointer b){
   return
@@ -63,9 +69,9 @@ gboolean append_filename_to_list (
   enum file_type ft= get_file_type(filename);
     if (ft == SCHEMA_POST){
         if (!skip_post)
-          *post_list=g_list_insert(*post_list,g_strdup(filename),-1);
+          *post_list=g_list_prepend(*post_list,g_strdup(filename));
     } else if (ft ==  SCHEMA_CREATE ){
-          *schema_create_list=g_list_insert(*schema_create_list,g_strdup(filename),-1);
+          *schema_create_list=g_list_prepend(*schema_create_list,g_strdup(filename));
     } else if (!source_db ||
       g_str_has_prefix(filename, g_strdup_printf("%s.", source_db))||
       g_str_has_prefix(filename, "mydumper_")) {
@@ -73,31 +79,33 @@ gboolean append_filename_to_list (
           case INIT:
             break;
           case SCHEMA_TABLE:
-            *create_table_list=g_list_append(*create_table_list,g_strdup(filename));
+            *create_table_list=g_list_prepend(*create_table_list,g_strdup(filename));
             break;
           case SCHEMA_VIEW:
-            *view_list=g_list_append(*view_list,g_strdup(filename));
+            *view_list=g_list_prepend(*view_list,g_strdup(filename));
             break;
           case SCHEMA_TRIGGER:
             if (!skip_triggers)
-              *trigger_list=g_list_append(*trigger_list,g_strdup(filename));
+              *trigger_list=g_list_prepend(*trigger_list,g_strdup(filename));
             break;
           case CHECKSUM:
-            *checksum_list=g_list_append(*checksum_list,g_strdup(filename));
+            *checksum_list=g_list_prepend(*checksum_list,g_strdup(filename));
             break;
           case METADATA_GLOBAL:
             break;
           case METADATA_TABLE:
             // TODO: we need to process this info
-            *metadata_list=g_list_append(*metadata_list,g_strdup(filename));
+            *metadata_list=g_list_prepend(*metadata_list,g_strdup(filename));
             break;
           case DATA:
             if (!no_data)
-              *data_files_list=g_list_append(*data_files_list,g_strdup(filename));
+              *data_files_list=g_list_prepend(*data_files_list,g_strdup(filename));
             break;
           case LOAD_DATA:
             g_message("Load data file found: %s", filename);
             break;
+          case MANIFEST:
+            break;
           case RESUME:
             if (inside_resume){
               g_critical("resume file found inside resume processing. You need to manually edit resume file");
@@ -127,7 +135,8 @@ gboolean append_filename_to_list (
                 read_data(file, FALSE, data, &eof, &line);
                 split=g_strsplit(data->str,"\n",0);
                 for (i=0; i<g_strv_length(split);i++){
-                  if (strlen(split[i])>2)
+                  // Byte ranges are listed once per range
+                  if (strlen(split[i])>2 && add_resume_range(split[i]))
                     append_filename_to_list(schema_create_list,create_table_list,metadata_list,data_files_list,view_list,trigger_list,post_list,checksum_list,split[i],TRUE);
                 }
                 g_string_set_size(data, 0);
@@ -146,16 +155,66 @@ gboolean append_filename_to_list (
 }
 
 
-void load_directory_information(struct configuration *conf) {
-  GError *error = NULL;
-  GDir *dir = g_dir_open(directory, 0, &error);
-
-  if (error) {
-    g_critical("cannot open directory %s, %s\n", directory, error->message);
-    errors++;
-    return;
+struct manifest_entry {
+  gchar *database;
+  gchar *table;
+  guint part;
+  guint sub_part;
+  guint64 size;
+  guint64 rows;
+  gchar *where;
+  gboolean has_checksum;
+  guint64 checksum;
+};
+
+// Reads the manifest written by mydumper at the end of the dump. It returns
+// the file names in the order of the manifest and fills data_files with the
+// information of each data file. NULL is returned when there is no valid
+// manifest, then the directory needs to be listed.
+static gchar **read_manifest(GHashTable *data_files){
+  gchar *path=g_build_filename(directory, "manifest", NULL);
+  gchar *content=NULL;
+  gchar **lines=NULL, **fields=NULL, *tab=NULL;
+  guint i=0, n=0;
+  if (!g_file_get_contents(path, &content, NULL, NULL)){
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+  lines=g_strsplit(content, "\n", -1);
+  g_free(content);
+  if (lines[0] == NULL || strcmp(lines[0], "# mydumper manifest 1")){
+    g_warning("Manifest version not supported, the directory is going to be listed");
+    g_strfreev(lines);
+    return NULL;
   }
+  for (i = 1; lines[i] != NULL; i++){
+    fields=g_strsplit(lines[i], "\t", 9);
+    n=g_strv_length(fields);
+    if (n >= 6){
+      struct manifest_entry *me=g_new(struct manifest_entry, 1);
+      me->database=g_strdup(fields[1]);
+      me->table=g_strdup(fields[2]);
+      me->part=g_ascii_strtoull(fields[3], NULL, 10);
+      me->sub_part=g_ascii_strtoull(fields[4], NULL, 10);
+      me->size=g_ascii_strtoull(fields[5], NULL, 10);
+      me->rows=n > 6 ? g_ascii_strtoull(fields[6], NULL, 10) : 0;
+      me->where=n > 7 ? g_strcompress(fields[7]) : g_strdup("");
+      // The checksum is empty when the dump was taken without --chunk-checksums
+      me->has_checksum=n > 8 && *fields[8] != '\0';
+      me->checksum=me->has_checksum ? g_ascii_strtoull(fields[8], NULL, 16) : 0;
+      g_hash_table_insert(data_files, g_strdup(fields[0]), me);
+    }
+    g_strfreev(fields);
+    // Only the file name is returned
+    tab=strchr(lines[i], '\t');
+    if (tab != NULL)
+      *tab='\0';
+  }
+  return lines;
+}
 
+void load_directory_information(struct configuration *conf) {
   const gchar *filename = NULL;
   GList *create_table_list=NULL,
         *metadata_list= NULL,
@@ -165,10 +224,43 @@ void load_directory_information(struct configuration *conf) {
         *trigger_list=NULL,
         *post_list=NULL;
   gboolean cont=TRUE;
-  while (cont && (filename = g_dir_read_name(dir)))
-    cont=append_filename_to_list(&schema_create_list,&create_table_list,&metadata_list,&data_files_list,&view_list,&trigger_list,&post_list,&(conf->checksum_list),filename,FALSE);
- 
-  g_dir_close(dir);
+  GHashTable *manifest_data_files=g_hash_table_new ( g_str_hash, g_str_equal );
+  gchar **manifest= resume ? NULL : read_manifest(manifest_data_files);
+  guint line=0;
+  if (manifest != NULL){
+    g_message("Using the manifest of the dump");
+    for (line = 1; cont && manifest[line] != NULL; line++)
+      if (*manifest[line] != '\0')
+        cont=append_filename_to_list(&schema_create_list,&create_table_list,&metadata_list,&data_files_list,&view_list,&trigger_list,&post_list,&(conf->checksum_list),manifest[line],FALSE);
+    g_strfreev(manifest);
+  }else{
+    GError *error = NULL;
+    GDir *dir = g_dir_open(directory, 0, &error);
+    // The row checksums of the chunks are only listed in the manifest
+    if (verify_chunk_checksums)
+      g_warning("%s, only the chunks checksummed by the server are going to be verified",
+                resume ? "The manifest is not used with --resume" : "There is no valid manifest");
+
+    if (error) {
+      g_critical("cannot open directory %s, %s\n", directory, error->message);
+      errors++;
+      return;
+    }
+
+    while (cont && (filename = g_dir_read_name(dir)))
+      cont=append_filename_to_list(&schema_create_list,&create_table_list,&metadata_list,&data_files_list,&view_list,&trigger_list,&post_list,&(conf->checksum_list),filename,FALSE);
+
+    g_dir_close(dir);
+  }
+  // The lists were built in reverse order
+  schema_create_list=g_list_reverse(schema_create_list);
+  create_table_list=g_list_reverse(create_table_list);
+  metadata_list=g_list_reverse(metadata_list);
+  data_files_list=g_list_reverse(data_files_list);
+  view_list=g_list_reverse(view_list);
+  trigger_list=g_list_reverse(trigger_list);
+  post_list=g_list_reverse(post_list);
+  conf->checksum_list=g_list_reverse(conf->checksum_list);
 
   gchar *f = NULL;
   // CREATE DATABASE
@@ -187,9 +279,17 @@ void load_directory_information(struct configuration *conf) {
   }
 
   // DATA FILES
+  struct manifest_entry *me=NULL;
+  struct db_table *dbt=NULL;
   while (data_files_list != NULL){
     f = data_files_list->data;
-    process_data_filename(f);
+    me=g_hash_table_lookup(manifest_data_files, f);
+    if (me != NULL){
+      dbt=process_data_file(f, me->database, me->table, me->part, me->sub_part, me->size);
+      if (dbt != NULL && me->has_checksum)
+        register_chunk_checksum(dbt, f, me->where, me->rows, me->checksum);
+    }else
+      process_data_filename(f);
 
     data_files_list=data_files_list->next;
   }
@@ -219,7 +319,7 @@ void load_directory_information(struct configuration *conf) {
     post_list=post_list->next;
   }
   // SORT DATA FILES TO ENQUEUE
-  // iterates over the dbt to create the jobs in the dbt->queue
+  // iterates over the dbt to create the jobs in the dbt->chunk_jobs
   // and sorts the dbt for the conf->table_list
   // in stream mode, it is not possible to sort the tables as 
   // we don't know the amount the rows, .metadata are sent at the end.
@@ -227,25 +327,140 @@ void load_directory_information(struct configuration *conf) {
   GHashTableIter iter;
   gchar * lkey;
   g_hash_table_iter_init ( &iter, conf->table_hash );
-  struct db_table *dbt=NULL;
+  dbt=NULL;
   while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
-    table_list=g_list_insert_sorted_with_data (table_list,dbt,&compare_dbt,conf->table_hash);
+    estimate_table_work(dbt);
+    table_list=g_list_prepend(table_list,dbt);
+    dbt->restore_job_list=g_list_sort(dbt->restore_job_list,&compare_filename_part);
+    split_data_restore_jobs(dbt);
     GList *i=dbt->restore_job_list; 
     while (i) {
-      g_async_queue_push(dbt->queue, new_job(JOB_RESTORE ,i->data,dbt->real_database));
+      g_ptr_array_add(dbt->chunk_jobs, new_job(JOB_RESTORE ,i->data,dbt->real_database));
+      // Ranges of a file are numbered as different parts
+      ((struct restore_job *)i->data)->data.drj->index=dbt->chunk_jobs->len;
       i=i->next;
     }
-    dbt->count=g_async_queue_length(dbt->queue);
+    dbt->count=dbt->chunk_jobs->len;
 //    g_debug("Setting count to: %d", dbt->count);
   }
-  conf->table_list=table_list;
+  conf->table_list=g_list_sort_with_data(table_list,&compare_dbt,conf->table_hash);
   // conf->table needs to be set.
 }
 
+// Data files are sorted by part, which follows the primary key as mydumper
+// splits the tables in ascending ranges. Each thread loading a table owns a
+// contiguous range of dbt->chunk_jobs and restores it in ascending order, so
+// the insert points of the threads in the clustered index stay apart.
+struct chunk_range {
+  guint next;
+  guint end;
+};
+
+// Must be called with dbt->mutex locked
+static struct chunk_range *largest_chunk_range(struct db_table *dbt){
+  struct chunk_range *largest=NULL, *r=NULL;
+  GList *l=dbt->chunk_ranges;
+  for (; l != NULL; l=l->next){
+    r=l->data;
+    if (largest == NULL || r->end - r->next > largest->end - largest->next)
+      largest=r;
+  }
+  return largest;
+}
+
+// Must be called with dbt->mutex locked
+static gboolean has_chunk_jobs_to_take(struct db_table *dbt){
+  if (!dbt->chunks_started)
+    return dbt->chunk_jobs->len > 0;
+  struct chunk_range *largest=largest_chunk_range(dbt);
+  return largest != NULL && largest->end - largest->next > 1;
+}
+
+// The first thread takes the whole table, the next ones take the upper half
+// of the largest range still pending, so the ranges stay contiguous. Must be
+// called with dbt->mutex locked.
+static struct chunk_range *take_chunk_range(struct db_table *dbt){
+  struct chunk_range *range=NULL;
+  if (!dbt->chunks_started){
+    dbt->chunks_started=TRUE;
+    if (dbt->chunk_jobs->len == 0)
+      return NULL;
+    range=g_new(struct chunk_range, 1);
+    range->next=0;
+    range->end=dbt->chunk_jobs->len;
+  }else{
+    struct chunk_range *largest=largest_chunk_range(dbt);
+    if (largest == NULL || largest->end - largest->next < 2)
+      return NULL;
+    range=g_new(struct chunk_range, 1);
+    range->next=largest->next + (largest->end - largest->next) / 2;
+    range->end=largest->end;
+    largest->end=range->next;
+  }
+  dbt->chunk_ranges=g_list_prepend(dbt->chunk_ranges, range);
+  return range;
+}
+
+// Returns the next job of the range, taking a new range when it is
+// finished. When there is nothing left to take the thread leaves the table
+// and *last tells whether it was the last thread loading it.
+static struct control_job *next_chunk_job(struct db_table *dbt, struct chunk_range **range, gboolean *last){
+  struct control_job *job=NULL;
+  guint i;
+  g_mutex_lock(dbt->mutex);
+  if (*range != NULL && (*range)->next == (*range)->end){
+    dbt->chunk_ranges=g_list_remove(dbt->chunk_ranges, *range);
+    g_free(*range);
+    *range=NULL;
+  }
+  if (*range == NULL)
+    *range=take_chunk_range(dbt);
+  if (*range != NULL){
+    job=g_ptr_array_index(dbt->chunk_jobs, (*range)->next);
+    (*range)->next++;
+    // The next jobs of the range are the ones this thread takes next, unless
+    // another thread splits the range before
+    for (i = (*range)->next; i < MIN((*range)->next + PREFETCH_AHEAD, (*range)->end); i++)
+      prefetch_restore_job(((struct control_job *)g_ptr_array_index(dbt->chunk_jobs, i))->data.restore_job);
+  }else{
+    dbt->current_threads--;
+    *last=dbt->current_threads == 0;
+    if (*last)
+      dbt->start_index_time=g_date_time_new_now_local();
+  }
+  g_mutex_unlock(dbt->mutex);
+  return job;
+}
+
+// table_list is sorted by estimated work, so a thread that runs out of jobs
+// goes back to the longest table that still has jobs and free thread slots
+// instead of moving on to the next shorter one. Tables without data are
+// still visited once, as their indexes need to be created.
+static struct db_table *next_table_to_load(GList *table_list, struct chunk_range **range){
+  struct db_table *dbt=NULL;
+  *range=NULL;
+  for (; table_list != NULL; table_list=table_list->next){
+    dbt=table_list->data;
+    g_mutex_lock(dbt->mutex);
+    if (has_chunk_jobs_to_take(dbt) ? dbt->current_threads < dbt->max_threads :
+        (dbt->chunk_jobs->len == 0 && dbt->current_threads == 0 && dbt->start_index_time == NULL)){
+      *range=take_chunk_range(dbt);
+      dbt->current_threads++;
+      if (dbt->start_time==NULL)
+        dbt->start_time=g_date_time_new_now_local();
+      g_mutex_unlock(dbt->mutex);
+      return dbt;
+    }
+    g_mutex_unlock(dbt->mutex);
+  }
+  return NULL;
+}
+
 void *process_directory_queue(struct thread_data * td) {
   struct db_table *dbt=NULL;
   struct control_job *job = NULL;
-  gboolean cont=TRUE;
+  struct chunk_range *range=NULL;
+  gboolean cont=TRUE, last=FALSE;
 
   // Step 1: creating databases
   while (cont){
@@ -260,73 +475,19 @@ void *process_directory_queue(struct thread_data * td) {
     cont=process_job(td, job);
   }
 
-  // Is this correct in a streaming scenario ?
-  GList *table_list=td->conf->table_list;
-  if (table_list == NULL ) {
-    dbt=NULL;
-  }else{
-    dbt=table_list->data;
-    g_mutex_lock(dbt->mutex);
-    dbt->current_threads++;
-    if (dbt->start_time==NULL)
-      dbt->start_time=g_date_time_new_now_local();
-    g_mutex_unlock(dbt->mutex);
-  }
-
-
   // Step 3: Load data
+  dbt=next_table_to_load(td->conf->table_list, &range);
   cont=TRUE;
   while (cont){
     if (dbt != NULL){
-      g_mutex_lock(dbt->mutex);
-      if (dbt->current_threads > dbt->max_threads){
-        dbt->current_threads--;
-        g_mutex_unlock(dbt->mutex);
-        table_list=table_list->next;
-        if (table_list == NULL ){
-          dbt=NULL;
-          continue;
-        }
-        dbt=table_list->data;
-        g_mutex_lock(dbt->mutex);
-        if (dbt->start_time==NULL) dbt->start_time=g_date_time_new_now_local();
-        dbt->current_threads++;
-        g_mutex_unlock(dbt->mutex);
-        continue;
-      }
-      g_mutex_unlock(dbt->mutex);
-
-      job = (struct control_job *)g_async_queue_try_pop(dbt->queue);
+      job = next_chunk_job(dbt, &range, &last);
 
       if (job == NULL){
-        g_mutex_lock(dbt->mutex);
-        dbt->current_threads--;
-        if (dbt->current_threads == 0){
-          dbt->current_threads--;
-          dbt->start_index_time=g_date_time_new_now_local();
-          g_mutex_unlock(dbt->mutex);
-          if (dbt->indexes != NULL) {
-            g_message("Thread %d restoring indexes `%s`.`%s`", td->thread_id,
-                  dbt->real_database, dbt->real_table);
-            guint query_counter=0;
-            restore_data_in_gstring(td, dbt->indexes, FALSE, &query_counter);
-          }
-          dbt->finish_time=g_date_time_new_now_local();
-        }else{
-          g_mutex_unlock(dbt->mutex);
-        }
-        guint max=dbt->max_threads;
-        table_list=table_list->next;
-        if (table_list == NULL ){
-          dbt=NULL;
-          continue;
+        if (last){
+          if (!enqueue_indexes(dbt))
+            build_indexes(td, dbt);
         }
-        dbt=table_list->data;
-        g_mutex_lock(dbt->mutex);
-        if (dbt->start_time==NULL) dbt->start_time=g_date_time_new_now_local();
-        dbt->max_threads = max;
-        dbt->current_threads++;
-        g_mutex_unlock(dbt->mutex);
+        dbt=next_table_to_load(td->conf->table_list, &range);
         continue;
       }
     }else{
@@ -374,12 +535,18 @@ void restore_from_directory(struct configuration *conf){
   for (n = 0; n < num_threads; n++) {
     g_async_queue_push(conf->database_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
   }
-  sync_threads_on_queue(conf->ready,conf->table_queue,"Step 2 completed, Tables created");
+  // There is no need to wait for all the tables to be created, threads
+  // start loading the data of a table as soon as it has been created
   for (n = 0; n < num_threads; n++) {
     g_async_queue_push(conf->table_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
   }
   // We need to sync all the threads before continue
   sync_threads_on_queue(conf->ready,conf->data_queue,"Step 3 completed, load data finished");
+  // Constraints are added by the loader threads after data_queue is closed,
+  // and they might need the indexes
+  wait_index_threads_to_finish();
+  // The chunks are read back once the indexes exist
+  enqueue_chunk_checksums(conf);
   for (n = 0; n < num_threads; n++) {
     g_async_queue_push(conf->data_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
   }
@@ -394,6 +561,9 @@ void restore_from_directory(struct configuration *conf){
     GTimeSpan diff1=g_date_time_difference(dbt->start_index_time,dbt->start_time);
     GTimeSpan diff2=g_date_time_difference(dbt->finish_time,dbt->start_index_time);
     g_message("%s\t| %s\t| %s\t| `%s`.`%s`",print_time(diff1),print_time(diff2),print_time(diff1+diff2),dbt->real_database,dbt->real_table);
+    if (commit_latency_target > 0)
+      g_message("Queries per transaction on `%s`.`%s`: %u, from %u to %u", dbt->real_database, dbt->real_table,
+                dbt->commit_size, dbt->min_commit_size, dbt->max_commit_size);
     t=t->next;
   }
   innodb_optimize_keys=FALSE;
@@ -0,0 +1,161 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "connection.h"
+#include "myloader.h"
+#include "myloader_common.h"
+#include "myloader_restore.h"
+#include "myloader_index.h"
+#include "trace.h"
+#include "control.h"
+
+extern gchar *set_names_str;
+extern GString *set_session;
+extern guint num_threads;
+extern gboolean innodb_optimize_keys;
+extern gboolean shutdown_triggered;
+extern gboolean stream;
+
+guint max_threads_for_index_creation = 0;
+guint index_sort_buffer_size = 0;
+
+static GAsyncQueue *index_queue = NULL;
+static GThread **index_threads = NULL;
+static struct thread_data *index_td = NULL;
+static struct db_table index_end;
+
+static GOptionEntry index_entries[] = {
+    {"max-threads-for-index-creation", 0, 0, G_OPTION_ARG_INT, &max_threads_for_index_creation,
+     "Maximum number of threads creating the indexes deferred by --innodb-optimize-keys. These connections are opened in addition to --threads. 0 uses the loader threads, default 0", NULL},
+    {"index-sort-buffer-size", 0, 0, G_OPTION_ARG_INT, &index_sort_buffer_size,
+     "Memory in MB that the index creation threads can use in total to sort the keys, 0 keeps the server default. Default 0", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_index_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, index_entries);
+}
+
+// Used by the index creation threads and, without them, by the loader thread
+// that finished the table. The ALTER takes a job slot like the data jobs, so
+// pausing or reducing the threads also holds back the index creation.
+void build_indexes(struct thread_data *td, struct db_table *dbt){
+  if (dbt->indexes != NULL){
+    g_message("Thread %d restoring indexes `%s`.`%s`", td->thread_id,
+              dbt->real_database, dbt->real_table);
+    guint query_counter=0;
+    control_job_begin();
+    guint64 ts=trace_begin();
+    restore_data_in_gstring(td, dbt->indexes, FALSE, &query_counter);
+    trace_end(ts, "index", "index", dbt->real_database, dbt->real_table, 0);
+    control_job_end();
+  }
+  dbt->finish_time=g_date_time_new_now_local();
+}
+
+void *index_thread(struct thread_data *td){
+  struct db_table *dbt=NULL;
+  metrics_set_thread(td->thread_id);
+  trace_set_thread(td->thread_id);
+  m_connect(td->thrconn, "myloader", NULL);
+
+  mysql_query(td->thrconn, set_names_str);
+  mysql_query(td->thrconn, "/*!40101 SET SQL_MODE='NO_AUTO_VALUE_ON_ZERO' */");
+  mysql_query(td->thrconn, "/*!40014 SET UNIQUE_CHECKS=0 */");
+  mysql_query(td->thrconn, "/*!40014 SET FOREIGN_KEY_CHECKS=0*/");
+  execute_gstring(td->thrconn, set_session);
+
+  // The sort buffer of online DDL is only configurable per session since
+  // MySQL 8.0.27, older servers keep using innodb_sort_buffer_size
+  if (index_sort_buffer_size > 0){
+    gchar *query=g_strdup_printf("SET SESSION innodb_ddl_buffer_size=%" G_GUINT64_FORMAT,
+                                 (guint64)index_sort_buffer_size * 1024 * 1024 / max_threads_for_index_creation);
+    if (mysql_query(td->thrconn, query))
+      g_warning("Thread %d: index sort buffer size not set: %s", td->thread_id, mysql_error(td->thrconn));
+    g_free(query);
+  }
+
+  while (1){
+    dbt=(struct db_table *)g_async_queue_pop(index_queue);
+    if (dbt == &index_end)
+      break;
+    if (!shutdown_triggered)
+      build_indexes(td, dbt);
+  }
+  mysql_close(td->thrconn);
+  mysql_thread_end();
+  g_debug("Index thread %d ending", td->thread_id);
+  return NULL;
+}
+
+// The index creation threads are only needed when the indexes are deferred.
+// In stream mode the indexes are still created as post table jobs, as it is
+// not known when the last data file of a table has been received.
+void initialize_index_threads(struct configuration *conf){
+  guint n=0;
+  if (!innodb_optimize_keys || stream)
+    max_threads_for_index_creation=0;
+  if (max_threads_for_index_creation == 0)
+    return;
+  index_queue=g_async_queue_new();
+  index_threads=g_new(GThread *, max_threads_for_index_creation);
+  index_td=g_new(struct thread_data, max_threads_for_index_creation);
+  for (n = 0; n < max_threads_for_index_creation; n++){
+    index_td[n].conf=conf;
+    index_td[n].thread_id=num_threads + n + 1;
+    index_td[n].thrconn=mysql_init(NULL);
+    index_td[n].current_database=NULL;
+    index_td[n].dbt=NULL;
+    index_td[n].transaction_bytes=0;
+    index_td[n].restored_bytes=0;
+    index_td[n].metrics_table=NULL;
+    index_td[n].pipeline=NULL;
+    memset(&(index_td[n].metrics), 0, sizeof(struct metrics_counters));
+    index_threads[n]=g_thread_create((GThreadFunc)index_thread, &index_td[n], TRUE, NULL);
+  }
+}
+
+// Called once the last data job of the table has finished, so the loader
+// thread can move on to another table. Returns FALSE when there is no index
+// creation pool and the caller needs to create the indexes itself.
+gboolean enqueue_indexes(struct db_table *dbt){
+  if (max_threads_for_index_creation == 0)
+    return FALSE;
+  if (dbt->indexes == NULL)
+    dbt->finish_time=g_date_time_new_now_local();
+  else
+    g_async_queue_push(index_queue, dbt);
+  return TRUE;
+}
+
+void wait_index_threads_to_finish(){
+  guint n=0;
+  if (max_threads_for_index_creation == 0)
+    return;
+  for (n = 0; n < max_threads_for_index_creation; n++)
+    g_async_queue_push(index_queue, &index_end);
+  for (n = 0; n < max_threads_for_index_creation; n++)
+    g_thread_join(index_threads[n]);
+  g_free(index_threads);
+  g_free(index_td);
+  g_async_queue_unref(index_queue);
+  max_threads_for_index_creation=0;
+}
@@ -30,6 +30,8 @@
 #include "myloader_restore_job.h"
 #include "myloader_control_job.h"
 #include "connection.h"
+#include "myloader_load_data.h"
+#include "trace.h"
 #include <errno.h>
 
 extern gchar *db;
@@ -51,7 +53,16 @@ void *loader_thread(struct thread_data *td) {
   td->thrconn = mysql_init(NULL);
   g_mutex_unlock(init_mutex);
   td->current_database=NULL;
-
+  td->dbt=NULL;
+  td->transaction_bytes=0;
+  td->restored_bytes=0;
+  td->metrics_table=NULL;
+  td->pipeline=NULL;
+  memset(&(td->metrics), 0, sizeof(struct metrics_counters));
+  metrics_set_thread(td->thread_id);
+  trace_set_thread(td->thread_id);
+
+  enable_local_infile(td->thrconn);
   m_connect(td->thrconn, "myloader", NULL);
 
   mysql_query(td->thrconn, set_names_str);
@@ -95,6 +106,7 @@ void *loader_thread(struct thread_data *td) {
     cont=process_job(td, job);
   }
 
+  finish_statement_pipeline(td);
   if (td->thrconn)
     mysql_close(td->thrconn);
   mysql_thread_end();
@@ -0,0 +1,189 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "myloader.h"
+#include "myloader_restore.h"
+#include "myloader_prepared.h"
+#include "myloader_load_data.h"
+#include "myloader_target_health.h"
+
+extern guint errors;
+extern gchar *set_names_str;
+
+gboolean load_data_local = FALSE;
+static gchar *connection_charset = NULL;
+
+static GOptionEntry load_data_entries[] = {
+    {"load-data-local", 0, 0, G_OPTION_ARG_NONE, &load_data_local,
+     "Converts the rows of the INSERT statements into a LOAD DATA LOCAL INFILE stream. The duplicate keys and conversion errors, which LOAD DATA LOCAL turns into warnings, are still reported as errors unless the INSERT has IGNORE", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_load_data_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, load_data_entries);
+}
+
+// Must be called before connecting. The loader threads connect one at a
+// time, so the character set is only taken once.
+void enable_local_infile(MYSQL *conn){
+  unsigned int local_infile=1;
+  if (!load_data_local)
+    return;
+  mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+  // LOAD DATA would use character_set_database instead of the one set by
+  // --set-names
+  if (connection_charset == NULL){
+    gchar *from=g_strstr_len(set_names_str, -1, "SET NAMES ");
+    connection_charset= from == NULL ? g_strdup("binary") : g_strndup(from + 10, strcspn(from + 10, " */"));
+  }
+}
+
+struct local_infile {
+  GString *rows;
+  gsize offset;
+};
+
+static int local_infile_init(void **ptr, const char *filename, void *userdata){
+  (void) filename;
+  ((struct local_infile *)userdata)->offset=0;
+  *ptr=userdata;
+  return 0;
+}
+
+static int local_infile_read(void *ptr, char *buf, unsigned int buf_len){
+  struct local_infile *li=ptr;
+  gsize len=MIN(buf_len, li->rows->len - li->offset);
+  memcpy(buf, li->rows->str + li->offset, len);
+  li->offset+=len;
+  return len;
+}
+
+static void local_infile_end(void *ptr){
+  (void) ptr;
+}
+
+static int local_infile_error(void *ptr, char *error_msg, unsigned int error_msg_len){
+  (void) ptr;
+  g_strlcpy(error_msg, "Error reading the rows of the INSERT", error_msg_len);
+  return 2000;
+}
+
+// The rows are sent in the default LOAD DATA format: tab separated fields,
+// one row per line, backslash as escape character and \N for NULL
+static void append_rows(struct prepared_insert *pi, GString *rows){
+  guint v=0, total=pi->rows * pi->columns;
+  gsize i=0;
+  const gchar *value=NULL;
+  g_string_set_size(rows, 0);
+  for (v = 0; v < total; v++){
+    gsize offset=g_array_index(pi->offsets, gsize, v);
+    if (offset == NULL_VALUE){
+      g_string_append(rows, "\\N");
+    }else{
+      value=pi->values->str + offset;
+      gulong length=g_array_index(pi->lengths, gulong, v);
+      for (i = 0; i < length; i++){
+        switch (value[i]){
+          case '\\': g_string_append(rows, "\\\\"); break;
+          case '\t': g_string_append(rows, "\\t"); break;
+          case '\n': g_string_append(rows, "\\n"); break;
+          case '\0': g_string_append(rows, "\\0"); break;
+          default: g_string_append_c(rows, value[i]);
+        }
+      }
+    }
+    g_string_append_c(rows, (v + 1) % pi->columns == 0 ? '\n' : '\t');
+  }
+}
+
+// Builds the LOAD DATA statement from the prefix of the INSERT, which is
+// INSERT [IGNORE] INTO `table` [(`column`,...)] VALUES
+static gchar *build_load_data_statement(GString *prefix){
+  gboolean ignore=g_str_has_prefix(prefix->str, "INSERT IGNORE INTO ");
+  gchar *table=g_strstr_len(prefix->str, prefix->len, "INTO ");
+  if (table == NULL || table[5] != '`')
+    return NULL;
+  table+=5;
+  gchar *table_end=g_strstr_len(table + 1, -1, "` ");
+  if (table_end == NULL)
+    return NULL;
+  table_end++;
+  gchar *columns=table_end + 1;
+  gchar *columns_end=g_strrstr(columns, ") VALUES");
+  return g_strdup_printf("LOAD DATA LOCAL INFILE 'myloader' %sINTO TABLE %.*s CHARACTER SET %s %.*s",
+                         ignore ? "IGNORE " : "", (int)(table_end - table), table, connection_charset,
+                         columns_end != NULL && *columns == '(' ? (int)(columns_end + 1 - columns) : 0, columns);
+}
+
+// With LOCAL, the server turns the duplicate keys and the conversion errors
+// that would make the INSERT fail into warnings and goes on with the next
+// row, so they are reported as errors. Only the first ones are logged.
+static gboolean check_load_data_warnings(struct thread_data *td, const gchar *query){
+  MYSQL_RES *res=NULL;
+  MYSQL_ROW row;
+  guint warnings=mysql_warning_count(td->thrconn);
+  if (warnings == 0)
+    return TRUE;
+  g_critical("Thread %d: %u warnings executing %s", td->thread_id, warnings, query);
+  if (!mysql_query(td->thrconn, "SHOW WARNINGS LIMIT 10") && (res = mysql_store_result(td->thrconn)) != NULL){
+    while ((row = mysql_fetch_row(res)))
+      g_warning("Thread %d: %s %s: %s", td->thread_id, row[0], row[1], row[2]);
+    mysql_free_result(res);
+  }
+  errors++;
+  return FALSE;
+}
+
+// Returns -1 when the INSERT needs to be sent as text
+int restore_insert_with_load_data(struct thread_data *td, struct prepared_insert *pi, GString *data, guint *query_counter){
+  if (!parse_insert(pi, data))
+    return -1;
+  gchar *query=build_load_data_statement(pi->prefix);
+  if (query == NULL)
+    return -1;
+  struct local_infile li;
+  li.rows=g_string_sized_new(data->len);
+  li.offset=0;
+  append_rows(pi, li.rows);
+  mysql_set_local_infile_handler(td->thrconn, &local_infile_init, &local_infile_read,
+                                 &local_infile_end, &local_infile_error, &li);
+  int r=0;
+  guint64 start=metrics_now();
+  if (mysql_query(td->thrconn, query)){
+    g_critical("Thread %d: error executing LOAD DATA: %s", td->thread_id, mysql_error(td->thrconn));
+    errors++;
+    r=1;
+  }else{
+    td->metrics.ns[METRICS_QUERY]+=metrics_now() - start;
+    td->metrics.rows+=mysql_affected_rows(td->thrconn);
+    record_statement_latency(metrics_now() - start);
+    // INSERT IGNORE skips the same rows without an error
+    gboolean no_warnings=g_str_has_prefix(pi->prefix->str, "INSERT IGNORE INTO ") || check_load_data_warnings(td, query);
+    r=count_query_and_commit(td, data->len, FALSE, query_counter);
+    if (!no_warnings)
+      r=1;
+  }
+  mysql_set_local_infile_default(td->thrconn);
+  g_string_free(li.rows, TRUE);
+  g_free(query);
+  g_string_set_size(data, 0);
+  return r;
+}
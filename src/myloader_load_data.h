@@ -0,0 +1,26 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_load_data_h
+#define _src_myloader_load_data_h
+#include "myloader.h"
+#include "myloader_prepared.h"
+
+void load_load_data_entries(GOptionGroup *main_group);
+void enable_local_infile(MYSQL *conn);
+int restore_insert_with_load_data(struct thread_data *td, struct prepared_insert *pi, GString *data, guint *query_counter);
+#endif
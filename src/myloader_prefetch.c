@@ -0,0 +1,293 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef ZWRAP_USE_ZSTD
+#include "../zstd/zstd_zlibwrapper.h"
+#else
+#include <zlib.h>
+#endif
+#include <errno.h>
+#include "myloader.h"
+#include "myloader_common.h"
+#include "myloader_restore_job.h"
+#include "myloader_prefetch.h"
+
+#define PREFETCH_CHUNK_SIZE 65536
+
+extern gchar *directory;
+extern gboolean shutdown_triggered;
+
+guint prefetch_threads = 1;
+guint prefetch_buffer_size = 128;
+
+static GAsyncQueue *prefetch_queue = NULL;
+static GThread **prefetch_thread = NULL;
+static GMutex *prefetch_mutex = NULL;
+static GCond *prefetch_cond = NULL;
+static guint64 buffered_bytes = 0;
+static guint64 buffer_limit = 0;
+static gboolean prefetch_shutdown = FALSE;
+static guint prefetch_hits = 0;
+static guint prefetch_misses = 0;
+static struct prefetch_buffer prefetch_end;
+static GList *prefetch_buffers = NULL;
+
+static GOptionEntry prefetch_entries[] = {
+    {"prefetch-threads", 0, 0, G_OPTION_ARG_INT, &prefetch_threads,
+     "Number of threads reading and decompressing data files ahead of the loader threads, 0 disables it. Default 1", NULL},
+    {"prefetch-buffer-size", 0, 0, G_OPTION_ARG_INT, &prefetch_buffer_size,
+     "Maximum amount of memory in MB used to hold prefetched data files. Default 128", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_prefetch_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, prefetch_entries);
+}
+
+// Must be called with prefetch_mutex locked. The buffer is shared between the
+// prefetch queue and the restore job, the last one to drop it frees it.
+static void unref_prefetch_buffer(struct prefetch_buffer *pb){
+  pb->ref--;
+  if (pb->ref > 0)
+    return;
+  buffered_bytes-=pb->accounted;
+  if (pb->data != NULL)
+    g_string_free(pb->data, TRUE);
+  prefetch_buffers=g_list_remove(prefetch_buffers, pb);
+  g_free(pb->filename);
+  g_free(pb);
+}
+
+// Reads the whole file into pb->data. Memory is accounted per chunk and the
+// thread waits while the pool is full. The read is abandoned, and the file
+// left to the loader thread, when it would not fit in the pool on its own or
+// when a loader thread asks for it before it is complete, as streaming it
+// is faster than waiting for the rest.
+static gboolean prefetch_file(struct prefetch_buffer *pb){
+  FILE *infile=NULL;
+  gboolean is_compressed=FALSE;
+  gboolean abandon=FALSE;
+  char buffer[PREFETCH_CHUNK_SIZE];
+  int len=0;
+  guint64 pending=pb->length;
+  struct stat st;
+  gchar *path = g_build_filename(directory, pb->filename, NULL);
+  // Files that cannot fit in the pool are not read at all. The size of a
+  // compressed file is only a lower bound of its content, which is checked
+  // again while it is read.
+  if (pb->length > buffer_limit || (pb->length == 0 && g_stat(path, &st) == 0 && (guint64)st.st_size > buffer_limit)){
+    g_free(path);
+    return FALSE;
+  }
+  ml_open(&infile,path,&is_compressed);
+  g_free(path);
+  if (!infile){
+    g_warning("Prefetch cannot open file %s (%d)", pb->filename, errno);
+    return FALSE;
+  }
+  // Byte ranges are only created over uncompressed files
+  if (pb->length > 0 && (is_compressed || fseeko(infile, pb->offset, SEEK_SET) != 0)){
+    if (!is_compressed)
+      fclose(infile);
+    else
+      gzclose((gzFile)infile);
+    return FALSE;
+  }
+  pb->data=g_string_sized_new(PREFETCH_CHUNK_SIZE);
+  while (!abandon){
+    if (!is_compressed)
+      len=fread(buffer, 1, pb->length > 0 ? MIN(pending, PREFETCH_CHUNK_SIZE) : PREFETCH_CHUNK_SIZE, infile);
+    else
+      len=gzread((gzFile)infile, buffer, PREFETCH_CHUNK_SIZE);
+    if (len <= 0)
+      break;
+    pending-=len;
+    g_mutex_lock(prefetch_mutex);
+    while (!pb->wanted && !prefetch_shutdown &&
+           buffered_bytes + len > buffer_limit && buffered_bytes > pb->accounted)
+      g_cond_wait(prefetch_cond, prefetch_mutex);
+    if (prefetch_shutdown || pb->wanted || pb->accounted + len > buffer_limit){
+      abandon=TRUE;
+    }else{
+      g_string_append_len(pb->data, buffer, len);
+      pb->accounted+=len;
+      buffered_bytes+=len;
+    }
+    g_mutex_unlock(prefetch_mutex);
+  }
+  if (!is_compressed) {
+    if (ferror(infile))
+      abandon=TRUE;
+    fclose(infile);
+  } else {
+    if (len < 0)
+      abandon=TRUE;
+    gzclose((gzFile)infile);
+  }
+  return !abandon;
+}
+
+void *prefetch_thread_function(void *data){
+  (void) data;
+  struct prefetch_buffer *pb=NULL;
+  while (1){
+    pb=(struct prefetch_buffer *)g_async_queue_pop(prefetch_queue);
+    if (pb == &prefetch_end)
+      break;
+    g_mutex_lock(prefetch_mutex);
+    // Do not keep reading ahead while the pool is full, the loader threads
+    // will take the queued files themselves if they get there first.
+    while (pb->status == PREFETCH_QUEUED && !prefetch_shutdown && !shutdown_triggered &&
+           buffered_bytes >= buffer_limit)
+      g_cond_wait(prefetch_cond, prefetch_mutex);
+    if (pb->status != PREFETCH_QUEUED || prefetch_shutdown || shutdown_triggered){
+      unref_prefetch_buffer(pb);
+      g_mutex_unlock(prefetch_mutex);
+      continue;
+    }
+    pb->status=PREFETCH_LOADING;
+    g_mutex_unlock(prefetch_mutex);
+
+    gboolean loaded=prefetch_file(pb);
+
+    g_mutex_lock(prefetch_mutex);
+    if (loaded){
+      pb->status=PREFETCH_READY;
+    }else{
+      buffered_bytes-=pb->accounted;
+      pb->accounted=0;
+      if (pb->data != NULL)
+        g_string_free(pb->data, TRUE);
+      pb->data=NULL;
+      pb->status=PREFETCH_SKIPPED;
+    }
+    unref_prefetch_buffer(pb);
+    g_cond_broadcast(prefetch_cond);
+    g_mutex_unlock(prefetch_mutex);
+  }
+  return NULL;
+}
+
+void initialize_prefetch(){
+  guint n=0;
+  prefetch_mutex=g_mutex_new();
+  prefetch_cond=g_cond_new();
+  prefetch_queue=g_async_queue_new();
+  buffer_limit=(guint64)prefetch_buffer_size * 1024 * 1024;
+  if (prefetch_threads == 0 || buffer_limit == 0){
+    prefetch_threads=0;
+    return;
+  }
+  prefetch_thread=g_new(GThread *, prefetch_threads);
+  for (n = 0; n < prefetch_threads; n++)
+    prefetch_thread[n]=g_thread_create((GThreadFunc)prefetch_thread_function, NULL, TRUE, NULL);
+}
+
+// Data files need to be enqueued in the same order that the loader threads
+// are going to request them, otherwise the pool fills up with files that
+// nobody is waiting for. Jobs already enqueued are skipped.
+void prefetch_restore_job(struct restore_job *rj){
+  if (prefetch_threads == 0 || rj->type != JOB_RESTORE_FILENAME || rj->data.drj->prefetch != NULL)
+    return;
+  struct prefetch_buffer *pb=g_new0(struct prefetch_buffer, 1);
+  pb->filename=g_strdup(rj->filename);
+  pb->offset=rj->data.drj->offset;
+  pb->length=rj->data.drj->length;
+  pb->status=PREFETCH_QUEUED;
+  pb->ref=2;
+  rj->data.drj->prefetch=pb;
+  g_mutex_lock(prefetch_mutex);
+  prefetch_buffers=g_list_prepend(prefetch_buffers, pb);
+  g_mutex_unlock(prefetch_mutex);
+  g_async_queue_push(prefetch_queue, pb);
+}
+
+GString *prefetch_take(struct restore_job *rj){
+  GString *data=NULL;
+  if (rj->type != JOB_RESTORE_FILENAME || rj->data.drj->prefetch == NULL)
+    return NULL;
+  struct prefetch_buffer *pb=rj->data.drj->prefetch;
+  g_mutex_lock(prefetch_mutex);
+  // A file still being read is abandoned at the next chunk and streamed by
+  // the loader thread
+  if (pb->status == PREFETCH_LOADING){
+    pb->wanted=TRUE;
+    g_cond_broadcast(prefetch_cond);
+    while (pb->status == PREFETCH_LOADING)
+      g_cond_wait(prefetch_cond, prefetch_mutex);
+  }
+  if (pb->status == PREFETCH_READY){
+    data=pb->data;
+    prefetch_hits++;
+  }else{
+    prefetch_misses++;
+  }
+  pb->status=PREFETCH_TAKEN;
+  g_mutex_unlock(prefetch_mutex);
+  return data;
+}
+
+void prefetch_release(struct restore_job *rj){
+  if (rj->type != JOB_RESTORE_FILENAME || rj->data.drj->prefetch == NULL)
+    return;
+  struct prefetch_buffer *pb=rj->data.drj->prefetch;
+  g_mutex_lock(prefetch_mutex);
+  // It might still be queued if the job was skipped because of a shutdown
+  if (pb->status == PREFETCH_LOADING){
+    pb->wanted=TRUE;
+    g_cond_broadcast(prefetch_cond);
+    while (pb->status == PREFETCH_LOADING)
+      g_cond_wait(prefetch_cond, prefetch_mutex);
+  }
+  pb->status=PREFETCH_TAKEN;
+  buffered_bytes-=pb->accounted;
+  pb->accounted=0;
+  if (pb->data != NULL)
+    g_string_free(pb->data, TRUE);
+  pb->data=NULL;
+  unref_prefetch_buffer(pb);
+  g_cond_broadcast(prefetch_cond);
+  g_mutex_unlock(prefetch_mutex);
+  rj->data.drj->prefetch=NULL;
+}
+
+void finish_prefetch(){
+  guint n=0;
+  if (prefetch_threads == 0)
+    return;
+  g_mutex_lock(prefetch_mutex);
+  prefetch_shutdown=TRUE;
+  g_cond_broadcast(prefetch_cond);
+  g_mutex_unlock(prefetch_mutex);
+  for (n = 0; n < prefetch_threads; n++)
+    g_async_queue_push(prefetch_queue, &prefetch_end);
+  for (n = 0; n < prefetch_threads; n++)
+    g_thread_join(prefetch_thread[n]);
+  g_free(prefetch_thread);
+  // Buffers of the jobs that were never restored, because of a shutdown or
+  // an error, are still referenced by them
+  while (prefetch_buffers != NULL){
+    struct prefetch_buffer *pb=prefetch_buffers->data;
+    pb->ref=1;
+    unref_prefetch_buffer(pb);
+  }
+  g_message("Data files prefetched: %u of %u", prefetch_hits, prefetch_hits + prefetch_misses);
+}
@@ -0,0 +1,46 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_prefetch_h
+#define _src_myloader_prefetch_h
+#include "myloader.h"
+
+struct restore_job;
+
+// Data files prefetched ahead of the job a loader thread is restoring
+#define PREFETCH_AHEAD 2
+
+enum prefetch_status { PREFETCH_QUEUED, PREFETCH_LOADING, PREFETCH_READY, PREFETCH_SKIPPED, PREFETCH_TAKEN };
+
+struct prefetch_buffer {
+  gchar *filename;
+  guint64 offset;
+  guint64 length;
+  enum prefetch_status status;
+  GString *data;
+  guint64 accounted;
+  gboolean wanted;
+  guint ref;
+};
+
+void load_prefetch_entries(GOptionGroup *main_group);
+void initialize_prefetch();
+void prefetch_restore_job(struct restore_job *rj);
+GString *prefetch_take(struct restore_job *rj);
+void prefetch_release(struct restore_job *rj);
+void finish_prefetch();
+#endif
@@ -0,0 +1,241 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <mysql.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "myloader.h"
+#include "myloader_restore.h"
+#include "myloader_prepared.h"
+#include "myloader_target_health.h"
+
+// MySQL does not accept more placeholders in a statement
+#define MAX_PLACEHOLDERS 65535
+
+extern guint errors;
+
+gboolean prepared_insert = FALSE;
+guint prepared_insert_rows = 100;
+
+static GOptionEntry prepared_entries[] = {
+    {"prepared-insert", 0, 0, G_OPTION_ARG_NONE, &prepared_insert,
+     "Parses the rows of the INSERT statements and executes them through prepared statements, so the server does not need to parse them", NULL},
+    {"prepared-insert-rows", 0, 0, G_OPTION_ARG_INT, &prepared_insert_rows,
+     "Rows bound on each execution of a prepared INSERT, default 100", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_prepared_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, prepared_entries);
+}
+
+static void close_prepared_statement(gpointer stmt){
+  mysql_stmt_close((MYSQL_STMT *)stmt);
+}
+
+// One prepared_insert is used per data file, the prepared statements are
+// reused by all the INSERT statements of the file with the same prefix.
+struct prepared_insert *new_prepared_insert(){
+  struct prepared_insert *pi=g_new0(struct prepared_insert, 1);
+  pi->prefix=g_string_sized_new(128);
+  pi->statements=g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, &close_prepared_statement);
+  pi->values=g_string_sized_new(4096);
+  pi->offsets=g_array_new(FALSE, FALSE, sizeof(gsize));
+  pi->lengths=g_array_new(FALSE, FALSE, sizeof(gulong));
+  return pi;
+}
+
+void free_prepared_insert(struct prepared_insert *pi){
+  g_hash_table_destroy(pi->statements);
+  g_string_free(pi->prefix, TRUE);
+  g_string_free(pi->values, TRUE);
+  g_array_free(pi->offsets, TRUE);
+  g_array_free(pi->lengths, TRUE);
+  g_free(pi->binds);
+  g_free(pi);
+}
+
+static void add_value(struct prepared_insert *pi, gsize offset, gulong length){
+  g_array_append_val(pi->offsets, offset);
+  g_array_append_val(pi->lengths, length);
+}
+
+// Parses a value as written by mydumper: NULL, a number or a string quoted
+// and escaped by mysql_real_escape_string(). Anything else, like hex or
+// CONVERT() values, is not supported.
+static const gchar *parse_value(struct prepared_insert *pi, const gchar *p, const gchar *end){
+  gsize offset=pi->values->len;
+  if (*p == '"' || *p == '\''){
+    gchar quote=*p, c;
+    for (p++; p < end; p++){
+      c=*p;
+      if (c == '\\' && p + 1 < end){
+        p++;
+        switch (*p){
+          case '0': c='\0'; break;
+          case 'n': c='\n'; break;
+          case 'r': c='\r'; break;
+          case 't': c='\t'; break;
+          case 'b': c='\b'; break;
+          case 'Z': c='\032'; break;
+          default: c=*p;
+        }
+      }else if (c == quote){
+        if (p + 1 < end && p[1] == quote)
+          p++;
+        else
+          break;
+      }
+      g_string_append_c(pi->values, c);
+    }
+    if (p >= end)
+      return NULL;
+    add_value(pi, offset, pi->values->len - offset);
+    return p + 1;
+  }
+  if (end - p >= 4 && !strncmp(p, "NULL", 4)){
+    add_value(pi, NULL_VALUE, 0);
+    return p + 4;
+  }
+  const gchar *from=p;
+  while (p < end && *p != '\0' && strchr("0123456789+-.eE", *p) != NULL)
+    p++;
+  if (p == from)
+    return NULL;
+  g_string_append_len(pi->values, from, p - from);
+  add_value(pi, offset, p - from);
+  return p;
+}
+
+// Splits the rows of the INSERT in pi->values. Returns FALSE if there is
+// anything that cannot be sent as a parameter.
+gboolean parse_insert(struct prepared_insert *pi, GString *data){
+  gchar *values=g_strstr_len(data->str, MIN(data->len, 4096), "VALUES");
+  if (values == NULL)
+    return FALSE;
+  const gchar *p=values + 6, *end=data->str + data->len;
+  gsize prefix_len=p - data->str;
+  guint columns=0;
+  if (pi->prefix->len != prefix_len || strncmp(pi->prefix->str, data->str, prefix_len)){
+    g_string_assign(pi->prefix, "");
+    g_string_append_len(pi->prefix, data->str, prefix_len);
+    g_hash_table_remove_all(pi->statements);
+    pi->columns=0;
+  }
+  g_string_set_size(pi->values, 0);
+  g_array_set_size(pi->offsets, 0);
+  g_array_set_size(pi->lengths, 0);
+  pi->rows=0;
+  while (p < end && *p != ';'){
+    if (*p != '(')
+      return FALSE;
+    columns=0;
+    do {
+      p=parse_value(pi, p + 1, end);
+      if (p == NULL || p >= end)
+        return FALSE;
+      columns++;
+    } while (*p == ',');
+    if (*p != ')' || (pi->columns != 0 && columns != pi->columns))
+      return FALSE;
+    pi->columns=columns;
+    pi->rows++;
+    for (p++; p < end && (*p == '\n' || *p == ','); p++);
+  }
+  return pi->rows > 0;
+}
+
+static MYSQL_STMT *get_prepared_statement(struct thread_data *td, struct prepared_insert *pi, guint rows){
+  MYSQL_STMT *stmt=g_hash_table_lookup(pi->statements, GUINT_TO_POINTER(rows));
+  guint r=0, c=0;
+  if (stmt != NULL)
+    return stmt;
+  GString *query=g_string_sized_new(pi->prefix->len + rows * pi->columns * 2 + rows * 3);
+  g_string_append(query, pi->prefix->str);
+  for (r = 0; r < rows; r++){
+    g_string_append(query, r == 0 ? "(" : ",(");
+    for (c = 0; c < pi->columns; c++)
+      g_string_append(query, c == 0 ? "?" : ",?");
+    g_string_append_c(query, ')');
+  }
+  stmt=mysql_stmt_init(td->thrconn);
+  if (stmt == NULL || mysql_stmt_prepare(stmt, query->str, query->len)){
+    g_warning("Thread %d: INSERT could not be prepared, it will be sent as text: %s", td->thread_id,
+              stmt != NULL ? mysql_stmt_error(stmt) : mysql_error(td->thrconn));
+    if (stmt != NULL)
+      mysql_stmt_close(stmt);
+    stmt=NULL;
+  }else
+    g_hash_table_insert(pi->statements, GUINT_TO_POINTER(rows), stmt);
+  g_string_free(query, TRUE);
+  return stmt;
+}
+
+// Returns -1 when the INSERT needs to be sent as text, which is only
+// possible before any row has been executed.
+int restore_insert_with_prepared_statement(struct thread_data *td, struct prepared_insert *pi, GString *data, guint *query_counter){
+  if (!parse_insert(pi, data))
+    return -1;
+  guint batch=MIN(MAX(prepared_insert_rows, 1), MAX_PLACEHOLDERS / pi->columns);
+  if (batch == 0)
+    return -1;
+  guint last=pi->rows % batch;
+  if ((pi->rows >= batch && get_prepared_statement(td, pi, batch) == NULL) ||
+      (last > 0 && get_prepared_statement(td, pi, last) == NULL))
+    return -1;
+  if (pi->binds_size < batch * pi->columns){
+    pi->binds_size=batch * pi->columns;
+    pi->binds=g_renew(MYSQL_BIND, pi->binds, pi->binds_size);
+  }
+  guint row=0, rows=0, i=0, v=0;
+  int r=0;
+  guint64 start=0;
+  for (row = 0; row < pi->rows; row+=rows){
+    rows=MIN(batch, pi->rows - row);
+    MYSQL_STMT *stmt=g_hash_table_lookup(pi->statements, GUINT_TO_POINTER(rows));
+    memset(pi->binds, 0, sizeof(MYSQL_BIND) * rows * pi->columns);
+    for (i = 0; i < rows * pi->columns; i++){
+      v=row * pi->columns + i;
+      gsize offset=g_array_index(pi->offsets, gsize, v);
+      // Values are sent as strings in the connection character set, the
+      // server converts them as it does with the literals of the INSERT
+      if (offset == NULL_VALUE){
+        pi->binds[i].buffer_type=MYSQL_TYPE_NULL;
+      }else{
+        pi->binds[i].buffer_type=MYSQL_TYPE_STRING;
+        pi->binds[i].buffer=pi->values->str + offset;
+        pi->binds[i].buffer_length=g_array_index(pi->lengths, gulong, v);
+      }
+    }
+    start=metrics_now();
+    // As with a plain INSERT, the rest of the statement is not executed
+    // after an error
+    if (mysql_stmt_bind_param(stmt, pi->binds) || mysql_stmt_execute(stmt)){
+      g_critical("Thread %d: error executing prepared INSERT: %s", td->thread_id, mysql_stmt_error(stmt));
+      errors++;
+      g_string_set_size(data, 0);
+      return 1;
+    }
+    td->metrics.rows+=mysql_stmt_affected_rows(stmt);
+    td->metrics.ns[METRICS_QUERY]+=metrics_now() - start;
+    record_statement_latency(metrics_now() - start);
+  }
+  r=count_query_and_commit(td, data->len, FALSE, query_counter);
+  g_string_set_size(data, 0);
+  return r;
+}
@@ -0,0 +1,42 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_prepared_h
+#define _src_myloader_prepared_h
+#include "myloader.h"
+
+// Offset of the NULL values in prepared_insert->offsets
+#define NULL_VALUE G_MAXSIZE
+
+struct prepared_insert {
+  GString *prefix;
+  guint columns;
+  guint rows;
+  GHashTable *statements;
+  GString *values;
+  GArray *offsets;
+  GArray *lengths;
+  MYSQL_BIND *binds;
+  guint binds_size;
+};
+
+void load_prepared_entries(GOptionGroup *main_group);
+struct prepared_insert *new_prepared_insert();
+gboolean parse_insert(struct prepared_insert *pi, GString *data);
+int restore_insert_with_prepared_statement(struct thread_data *td, struct prepared_insert *pi, GString *data, guint *query_counter);
+void free_prepared_insert(struct prepared_insert *pi);
+#endif
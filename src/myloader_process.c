@@ -14,6 +14,7 @@
 
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
+
 #include <mysql.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -32,17 +33,20 @@
 #include "myloader_jobs_manager.h"
 #include "myloader_control_job.h"
 #include "myloader_restore_job.h"
+#include "myloader_prefetch.h"
 
 extern gchar *compress_extension;
 extern gchar *db;
 extern gboolean stream;
 extern guint max_threads_per_table; 
+extern guint split_data_file_size;
 extern gchar *directory;
 extern guint errors;
 extern guint total_data_sql_files;
 extern gboolean no_delete;
 extern GHashTable *tbl_hash;
 extern gboolean innodb_optimize_keys;
+extern guint commit_count;
 
 struct configuration *conf;
 GMutex *table_hash_mutex=NULL;
@@ -74,16 +78,26 @@ struct db_table* append_new_db_table(char * filename, gchar * database, gchar *t
     dbt->table=g_strdup(table);
     dbt->real_table=dbt->table;
     dbt->rows=number_rows;
+    dbt->data_size=0;
+    dbt->work=0;
     dbt->restore_job_list = NULL;
-    dbt->queue=g_async_queue_new();
+    dbt->chunk_checksums = NULL;
+    dbt->chunk_jobs=g_ptr_array_new();
+    dbt->chunk_ranges=NULL;
+    dbt->chunks_started=FALSE;
+    dbt->commit_size=commit_count;
+    dbt->min_commit_size=commit_count;
+    dbt->max_commit_size=commit_count;
     dbt->current_threads=0;
     dbt->max_threads=max_threads_per_table;
+    dbt->in_ready_table_queue=FALSE;
     dbt->mutex=g_mutex_new();
     dbt->indexes=alter_table_statement;
     dbt->start_time=NULL;
     dbt->start_index_time=NULL;
     dbt->finish_time=NULL;
-    dbt->schema_created=FALSE;
+    dbt->schema_state=NOT_FOUND;
+    dbt->schema_cond=g_cond_new();
     dbt->count=0;
     g_hash_table_insert(table_hash, g_strdup_printf("%s_%s",dbt->database,dbt->table),dbt);
   }else{
@@ -179,6 +193,9 @@ void load_schema(struct db_table *dbt, gchar *filename){
   }
   struct restore_job * rj = //new_restore_job(g_strdup(filename), /*dbt->real_database,*/ dbt, create_table_statement, 0, 0, JOB_RESTORE_SCHEMA_STRING, "");
   new_schema_restore_job(filename,JOB_RESTORE_SCHEMA_STRING, dbt, dbt->real_database, create_table_statement, "");
+  g_mutex_lock(dbt->mutex);
+  dbt->schema_state=NOT_CREATED;
+  g_mutex_unlock(dbt->mutex);
   g_async_queue_push(conf->table_queue, new_job(JOB_RESTORE,rj,dbt->real_database));
   if (!is_compressed) {
     fclose(infile);
@@ -373,12 +390,16 @@ void process_schema_filename(gchar *filename, const char * object) {
 }
 
 gint compare_filename_part (gconstpointer a, gconstpointer b){
-  return ((struct restore_job *)a)->data.drj->part == ((struct restore_job *)b)->data.drj->part ? ((struct restore_job *)a)->data.drj->sub_part > ((struct restore_job *)b)->data.drj->sub_part : ((struct restore_job *)a)->data.drj->part > ((struct restore_job *)b)->data.drj->part ;
+  const struct data_restore_job *a_drj=((struct restore_job *)a)->data.drj, *b_drj=((struct restore_job *)b)->data.drj;
+  if (a_drj->part != b_drj->part)
+    return a_drj->part > b_drj->part ? 1 : -1;
+  if (a_drj->sub_part != b_drj->sub_part)
+    return a_drj->sub_part > b_drj->sub_part ? 1 : -1;
+  return 0;
 }
 
 void process_data_filename(char * filename){
   gchar *db_name, *table_name;
-  total_data_sql_files++;
   // TODO: check if it is a data file
   // TODO: we need to count sections of the data file to determine if it is ok.
   guint part=0,sub_part=0;
@@ -387,19 +408,180 @@ void process_data_filename(char * filename){
     g_critical("It was not possible to process file: %s (3)",filename);
     exit(EXIT_FAILURE);
   }
+  struct stat st;
+  gchar *path=g_build_filename(directory, filename, NULL);
+  gboolean has_size=g_stat(path, &st) == 0;
+  g_free(path);
+  process_data_file(filename, db_name, table_name, part, sub_part, has_size ? (guint64)st.st_size : 0);
+}
+
+// The database, table, part and size come from the file name and the file
+// system, or from the manifest of the dump. It returns the table of the
+// file, or NULL when the table is skipped.
+struct db_table *process_data_file(char * filename, gchar *db_name, gchar *table_name, guint part, guint sub_part, guint64 size){
+  total_data_sql_files++;
   char *real_db_name=db_hash_lookup(db_name);
   if (!eval_table(real_db_name, table_name)){
     g_warning("Skiping table: `%s`.`%s`",real_db_name, table_name);
-    return;
+    return NULL;
   }
   struct db_table *dbt=append_new_db_table(filename, db_name, table_name,0,conf->table_hash,NULL);
   g_mutex_lock(dbt->mutex);
+  dbt->data_size+= size * (g_str_has_suffix(filename, compress_extension) ? COMPRESSION_RATIO_ESTIMATE : 1);
   dbt->count++; 
   struct restore_job *rj = //new_restore_job(g_strdup(filename), /*dbt->real_database,*/ dbt, NULL, part, sub_part, JOB_RESTORE_FILENAME, "");
     new_data_restore_job( g_strdup(filename), JOB_RESTORE_FILENAME, dbt, part, sub_part);
-  dbt->restore_job_list=g_list_insert_sorted(dbt->restore_job_list,rj,&compare_filename_part);
+  // In a stream scenario, files are restored as soon as they arrive, so it
+  // needs to be enqueued before the job is visible to the loader threads
+  // In directory mode, restore_job_list is sorted once all the files have
+  // been processed
+  if (stream){
+    prefetch_restore_job(rj);
+    dbt->restore_job_list=g_list_insert_sorted(dbt->restore_job_list,rj,&compare_filename_part);
+    push_ready_table(dbt);
+  }else
+    dbt->restore_job_list=g_list_prepend(dbt->restore_job_list,rj);
   g_mutex_unlock(dbt->mutex);
+  return dbt;
+}
+
+// Returns the offset where the first INSERT of the data file starts, or 0 if
+// it is not found in the first MB.
+guint64 get_data_file_header_length(FILE *infile){
+  char buffer[256];
+  gboolean new_line=TRUE;
+  guint64 position=0;
+  while (position < 1024*1024 && fgets(buffer, sizeof(buffer), infile) != NULL){
+    if (new_line && g_str_has_prefix(buffer, "INSERT"))
+      return position;
+    new_line=buffer[strlen(buffer) - 1] == '\n';
+    position=ftello(infile);
+  }
+  return 0;
+}
+
+// Returns the offset of the first statement that starts after from, which is
+// the next line after a line that finishes with ";\n", or 0 if there is none.
+guint64 get_next_statement_boundary(FILE *infile, guint64 from){
+  char buffer[256];
+  char previous='\0';
+  size_t len=0;
+  if (fseeko(infile, from, SEEK_SET) != 0)
+    return 0;
+  while (fgets(buffer, sizeof(buffer), infile) != NULL){
+    len=strlen(buffer);
+    if (buffer[len - 1] == '\n' && (len > 1 ? buffer[len - 2] : previous) == ';')
+      return ftello(infile);
+    previous=buffer[len - 1];
+  }
+  return 0;
 }
 
+struct resume_range {
+  guint64 header_length;
+  guint64 offset;
+  guint64 length;
+};
+
+// Byte ranges that were pending when the restore was interrupted, by file
+static GHashTable *resume_ranges=NULL;
+
+// A line of the resume file is either a file name or a pending byte range,
+// "filename\theader_length\toffset\tlength". The line is truncated to the
+// file name and it returns TRUE when the file has to be added to the list.
+gboolean add_resume_range(gchar *line){
+  gchar **fields=g_strsplit(line, "\t", 4);
+  gboolean first=TRUE;
+  if (g_strv_length(fields) == 4){
+    struct resume_range *rr=g_new(struct resume_range, 1);
+    rr->header_length=g_ascii_strtoull(fields[1], NULL, 10);
+    rr->offset=g_ascii_strtoull(fields[2], NULL, 10);
+    rr->length=g_ascii_strtoull(fields[3], NULL, 10);
+    *strchr(line, '\t')='\0';
+    if (resume_ranges == NULL)
+      resume_ranges=g_hash_table_new(g_str_hash, g_str_equal);
+    GList *ranges=g_hash_table_lookup(resume_ranges, line);
+    first=ranges == NULL;
+    if (first)
+      g_hash_table_insert(resume_ranges, g_strdup(line), g_list_append(NULL, rr));
+    else
+      ranges=g_list_append(ranges, rr);
+  }
+  g_strfreev(fields);
+  return first;
+}
 
+static GList *resumed_data_restore_job(struct restore_job *rj, GList *resumed){
+  GList *ranges=NULL;
+  struct resume_range *rr=NULL;
+  for (; resumed != NULL; resumed=resumed->next){
+    rr=resumed->data;
+    ranges=g_list_prepend(ranges, new_data_range_restore_job(rj, rr->header_length, rr->offset, rr->length));
+  }
+  total_data_sql_files+=g_list_length(ranges) - 1;
+  g_message("Data file %s will be resumed in %d parts", rj->filename, g_list_length(ranges));
+  g_free(rj->data.drj);
+  g_free(rj);
+  return g_list_reverse(ranges);
+}
 
+// A data file is a single restore job, which means that a table dumped in a
+// single file is restored by a single thread. When the file is uncompressed
+// and big enough, we split it in byte ranges that start and finish on
+// statement boundaries and we enqueue each range as a different job.
+GList *split_data_restore_job(struct restore_job *rj, guint max_ranges){
+  GList *ranges=NULL;
+  struct stat st;
+  guint64 split_size=(guint64)split_data_file_size * 1024 * 1024;
+  GList *resumed=resume_ranges != NULL ? g_hash_table_lookup(resume_ranges, rj->filename) : NULL;
+  if (resumed != NULL)
+    return resumed_data_restore_job(rj, resumed);
+  gchar *path=g_build_filename(directory, rj->filename, NULL);
+  if (split_size == 0 || max_ranges < 2 || g_str_has_suffix(rj->filename, compress_extension) ||
+      g_stat(path, &st) != 0 || (guint64)st.st_size < 2 * split_size){
+    g_free(path);
+    return g_list_append(ranges, rj);
+  }
+  guint64 size=st.st_size;
+  guint n=MIN(max_ranges, size / split_size);
+  FILE *infile=g_fopen(path, "r");
+  g_free(path);
+  if (infile == NULL)
+    return g_list_append(ranges, rj);
+  guint64 header_length=get_data_file_header_length(infile);
+  guint64 from=0, to=0;
+  guint i=0;
+  for (i = 1; i < n; i++){
+    to=get_next_statement_boundary(infile, size * i / n);
+    if (to <= from || to >= size)
+      continue;
+    ranges=g_list_prepend(ranges, new_data_range_restore_job(rj, header_length, from, to - from));
+    from=to;
+  }
+  fclose(infile);
+  if (ranges == NULL)
+    return g_list_append(ranges, rj);
+  ranges=g_list_prepend(ranges, new_data_range_restore_job(rj, header_length, from, size - from));
+  total_data_sql_files+=g_list_length(ranges) - 1;
+  g_message("Data file %s will be restored in %d parts", rj->filename, g_list_length(ranges));
+  // The original job is replaced by the ranges
+  g_free(rj->data.drj);
+  g_free(rj);
+  return g_list_reverse(ranges);
+}
+
+void split_data_restore_jobs(struct db_table *dbt){
+  guint files=g_list_length(dbt->restore_job_list);
+  // The pending ranges of a resumed restore are used even if the file
+  // would not be split now
+  if (files == 0 || (resume_ranges == NULL && (split_data_file_size == 0 || files >= dbt->max_threads)))
+    return;
+  guint max_ranges=files < dbt->max_threads ? (dbt->max_threads + files - 1) / files : 1;
+  GList *restore_job_list=NULL, *i=dbt->restore_job_list;
+  while (i) {
+    restore_job_list=g_list_concat(restore_job_list, split_data_restore_job(i->data, max_ranges));
+    i=i->next;
+  }
+  g_list_free(dbt->restore_job_list);
+  dbt->restore_job_list=restore_job_list;
+}
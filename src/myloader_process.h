@@ -21,6 +21,10 @@ void process_table_filename(char * filename);
 void process_metadata_filename( GHashTable *table_hash, char * filename);
 void process_schema_filename(gchar *filename, const char * object);
 void process_data_filename(char * filename);
+struct db_table *process_data_file(char * filename, gchar *db_name, gchar *table_name, guint part, guint sub_part, guint64 size);
 //struct job * new_job (enum job_type type, void *job_data, char *use_database);
 struct db_table* append_new_db_table(char * filename, gchar * database, gchar *table, guint64 number_rows, GHashTable *table_hash, GString *alter_table_statement);
 void initialize_process(struct configuration *c);
+void split_data_restore_jobs(struct db_table *dbt);
+gboolean add_resume_range(gchar *line);
+gint compare_filename_part (gconstpointer a, gconstpointer b);
@@ -14,6 +14,7 @@
 
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
+
 #include <mysql.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -29,55 +30,147 @@
 #include "myloader.h"
 #include "myloader_jobs_manager.h"
 #include "myloader_common.h"
+#include "myloader_restore.h"
+#include "myloader_prepared.h"
+#include "myloader_load_data.h"
+#include "control.h"
+#include "myloader_target_health.h"
 extern guint errors;
 extern guint commit_count;
 extern gchar *directory;
 extern gchar *compress_extension;
 extern guint rows;
+extern gboolean prepared_insert;
+extern gboolean load_data_local;
 
 gboolean skip_definer = FALSE;
+guint commit_latency_target = 0;
+guint statement_pipeline_depth = 4;
+
+// Transactions are committed once they reach this size, whatever the commit
+// time is, to keep the undo log small
+#define MAX_TRANSACTION_BYTES (256 * 1024 * 1024)
 
 static GOptionEntry restore_entries[] = {
     {"skip-definer", 0, 0, G_OPTION_ARG_NONE, &skip_definer,
      "Removes DEFINER from the CREATE statement. By default, statements are not modified", NULL},
+    {"statement-pipeline-depth", 0, 0, G_OPTION_ARG_INT, &statement_pipeline_depth,
+     "Number of statements of a data file read ahead by a reader thread of each loader thread while it executes them, 0 disables it. Prefetched files are not read ahead. Default 4", NULL},
+    {"commit-latency-target", 0, 0, G_OPTION_ARG_INT, &commit_latency_target,
+     "Target time in milliseconds of each COMMIT. The queries per transaction of each table start at --queries-per-transaction and are adjusted toward it. 0 disables it, default 0", NULL},
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 void load_restore_entries(GOptionGroup *main_group){
   g_option_group_add_entries(main_group, restore_entries);
 }
 
-int restore_data_in_gstring_by_statement(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter)
+// Only the data of a table is committed in adaptive batches, td->dbt is set
+// while a data file is being restored. The size is returned before the
+// scaling of the health checks, which is applied by the caller.
+static guint get_commit_size(struct thread_data *td){
+  guint commit_size=commit_count;
+  if (commit_latency_target > 0 && td->dbt != NULL){
+    g_mutex_lock(td->dbt->mutex);
+    commit_size=td->dbt->commit_size;
+    g_mutex_unlock(td->dbt->mutex);
+  }
+  return commit_size;
+}
+
+// Scales the size of the last batch by how far its COMMIT was from the
+// target, at most by half or double, and averages it with the current size
+// as all the threads loading the table share it.
+static void adapt_commit_size(struct db_table *dbt, guint queries, guint64 bytes, gint64 elapsed){
+  gdouble ratio=elapsed > 0 ? (gdouble)commit_latency_target * G_TIME_SPAN_MILLISECOND / elapsed : 2;
+  guint next=queries * CLAMP(ratio, 0.5, 2);
+  if (bytes >= MAX_TRANSACTION_BYTES)
+    next=MIN(next, queries);
+  g_mutex_lock(dbt->mutex);
+  dbt->commit_size=MAX((dbt->commit_size + next) / 2, 2);
+  if (dbt->commit_size < dbt->min_commit_size)
+    dbt->min_commit_size=dbt->commit_size;
+  if (dbt->commit_size > dbt->max_commit_size)
+    dbt->max_commit_size=dbt->commit_size;
+  g_mutex_unlock(dbt->mutex);
+}
+
+int restore_data_in_buffer_by_statement(struct thread_data *td, const gchar *buffer, gsize len, gboolean is_schema, guint *query_counter)
 {
-  if (mysql_real_query(td->thrconn, data->str, data->len)) {
-    //g_critical("Error restoring: %s %s", data->str, mysql_error(conn));
+  guint64 start=metrics_now();
+  if (mysql_real_query(td->thrconn, buffer, len)) {
+    //g_critical("Error restoring: %s %s", buffer, mysql_error(conn));
     errors++;
     return 1;
   }
+  td->metrics.ns[METRICS_QUERY]+=metrics_now() - start;
+  if (!is_schema){
+    td->metrics.rows+=mysql_affected_rows(td->thrconn);
+    record_statement_latency(metrics_now() - start);
+  }
+  return count_query_and_commit(td, len, is_schema, query_counter);
+}
+
+// Commits the transaction when the statement just executed completes it.
+// The time spent executing the statement has already been added to the
+// metrics of the thread, which are flushed per transaction while a table is
+// restored and per statement otherwise.
+int count_query_and_commit(struct thread_data *td, gsize len, gboolean is_schema, guint *query_counter)
+{
+  guint commit_size=0, batch_size=0;
   *query_counter=*query_counter+1;
-  if (!is_schema && (commit_count > 1) &&(*query_counter == commit_count)) {
+  td->transaction_bytes+=len;
+  td->restored_bytes+=len;
+  td->metrics.bytes+=len;
+  control_throttle(len);
+  if (!is_schema && (commit_count > 1)){
+    commit_size=get_commit_size(td);
+    batch_size=adapt_batch_size(commit_size);
+  }
+  if (batch_size > 0 && (*query_counter >= batch_size ||
+      (commit_latency_target > 0 && td->transaction_bytes >= MAX_TRANSACTION_BYTES))) {
+    guint queries=*query_counter;
+    gint64 start=g_get_monotonic_time();
     *query_counter= 0;
     if (mysql_query(td->thrconn, "COMMIT")) {
       errors++;
       return 2;
     }
+    td->metrics.ns[METRICS_COMMIT]+=(g_get_monotonic_time() - start) * 1000;
+    // The size is adapted as if the batch had not been scaled, as it is
+    // scaled again when it is read
+    if (commit_latency_target > 0 && td->dbt != NULL)
+      adapt_commit_size(td->dbt, (guint64)queries * commit_size / batch_size, td->transaction_bytes, g_get_monotonic_time() - start);
+    td->transaction_bytes=0;
+    // A pause only stops the thread between two transactions, so it does
+    // not keep the row locks of the batch
+    control_wait_resume();
     mysql_query(td->thrconn, "START TRANSACTION");
+    metrics_flush_table(td->metrics_table, &(td->metrics));
+  }else if (td->dbt == NULL){
+    metrics_flush_table(NULL, &(td->metrics));
   }
-  g_string_set_size(data, 0);
   return 0;
 }
 
+int restore_data_in_gstring_by_statement(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter)
+{
+  int r=restore_data_in_buffer_by_statement(td, data->str, data->len, is_schema, query_counter);
+  if (r == 0)
+    g_string_set_size(data, 0);
+  return r;
+}
+
 int restore_data_in_gstring(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter)
 {
-  int i=0;
   int r=0;
+  const gchar *statement=NULL;
+  gsize statement_len=0;
+  struct statement_iterator si;
   if (data != NULL && data->len > 4){
-    gchar** line=g_strsplit(data->str, ";\n", -1);
-    for (i=0; i < (int)g_strv_length(line);i++){
-       if (strlen(line[i])>2){
-         GString *str=g_string_new(line[i]);
-         g_string_append_c(str,';');
-         r+=restore_data_in_gstring_by_statement(td, str, is_schema, query_counter);
-       }
+    initialize_statement_iterator(&si, data->str, data->len);
+    while (next_statement(&si, &statement, &statement_len)){
+      if (statement_len > 2)
+        r+=restore_data_in_buffer_by_statement(td, statement, statement_len, is_schema, query_counter);
     }
   }
   return r;
@@ -86,57 +179,220 @@ int restore_data_in_gstring(struct thread_data *td, GString *data, gboolean is_s
 int split_and_restore_data_in_gstring_by_statement(struct thread_data *td,
                   GString *data, gboolean is_schema, guint *query_counter, guint offset_line)
 {
-  char *next_line=g_strstr_len(data->str,-1,"VALUES") + 6;
-  char *insert_statement_prefix=g_strndup(data->str,next_line - data->str);
-  guint insert_statement_prefix_len=strlen(insert_statement_prefix);
-  int r=0;
-  guint tr=0,current_offset_line=offset_line-1;
-  gchar *current_line=next_line;
-  next_line=g_strstr_len(current_line, -1, "\n");
-  GString * new_insert=g_string_sized_new(strlen(insert_statement_prefix));
-  guint current_rows=0;
-  do {
-    current_rows=0;
-    g_string_set_size(new_insert, 0);
-    new_insert=g_string_append(new_insert,insert_statement_prefix);
-    do {
-      char *line=g_strndup(current_line, next_line - current_line);
-      g_string_append(new_insert, line);
-      g_free(line);
-      current_rows++;
-      current_line=next_line+1;
-      next_line=g_strstr_len(current_line, -1, "\n");
-      current_offset_line++;
-    } while (current_rows < rows && next_line != NULL);
-    if (new_insert->len > insert_statement_prefix_len)
-      tr=restore_data_in_gstring_by_statement(td, new_insert, is_schema, query_counter);
-    else
-      tr=0;
+  struct insert_splitter is;
+  const gchar *statement=NULL;
+  gsize statement_len=0;
+  guint first_line=0, last_line=0;
+  int r=0, tr=0;
+  if (!initialize_insert_splitter(&is, data, offset_line))
+    return restore_data_in_gstring_by_statement(td, data, is_schema, query_counter);
+  while (next_insert_rows(&is, adapt_batch_size(rows), &statement, &statement_len, &first_line, &last_line)) {
+    tr=restore_data_in_buffer_by_statement(td, statement, statement_len, is_schema, query_counter);
     r+=tr;
     if (tr > 0){
-      g_critical("Error occurs between lines: %d and %d in a splited INSERT: %s",offset_line,current_offset_line,mysql_error(td->thrconn));
+      g_critical("Error occurs between lines: %d and %d in a splited INSERT: %s",first_line,last_line,mysql_error(td->thrconn));
     }
-    offset_line=current_offset_line+1;
-    current_line++; // remove trailing ,
-  } while (next_line != NULL);
-  g_string_free(new_insert,TRUE);
-  g_free(insert_statement_prefix);
-  g_string_set_size(data, 0);
+  }
+  finish_insert_splitter(&is, data);
   return r;
+}
 
+// Executes the statements before the first INSERT of a data file, which set
+// the session as it was when the file was dumped. It is needed when a thread
+// starts restoring a data file from the middle.
+static int restore_data_file_header(struct thread_data *td, const gchar *path, const char *filename, guint64 header_length){
+  guint query_counter=0;
+  int r=0;
+  FILE *infile=g_fopen(path, "r");
+  if (!infile) {
+    g_critical("cannot open file %s (%d)", filename, errno);
+    errors++;
+    return 1;
+  }
+  GString *header=g_string_sized_new(header_length);
+  g_string_set_size(header, header_length);
+  if (fread(header->str, 1, header_length, infile) != header_length){
+    g_critical("error reading file %s (%d)", filename, errno);
+    errors++;
+    r=1;
+  }else{
+    r=restore_data_in_gstring(td, header, TRUE, &query_counter);
+  }
+  g_string_free(header, TRUE);
+  fclose(infile);
+  return r;
 }
 
 int restore_data_from_file(struct thread_data *td, char *database, char *table,
-                  const char *filename, gboolean is_schema){
+                  const char *filename, gboolean is_schema, GString *prefetched){
+  return restore_data_from_file_range(td, database, table, filename, is_schema, prefetched, 0, 0, 0);
+}
+
+struct statement_reader {
   FILE *infile;
-  int r=0;
-  gboolean is_compressed = FALSE;
-  gboolean eof = FALSE;
+  gboolean is_compressed;
+  GString *prefetched;
+  gsize buffer_offset;
+  guint64 end;
+  gboolean eof;
+  guint line;
+};
+
+// Reads lines into data until it holds a whole statement. Returns 1 when a
+// statement was read, 0 at the end of the file or range and -1 on error.
+static int read_next_statement(struct statement_reader *sr, GString *data){
+  while (!sr->eof){
+    if (!(sr->prefetched != NULL ?
+          read_data_from_buffer(sr->prefetched, &sr->buffer_offset, data, &sr->eof, &sr->line) :
+          read_data(sr->infile, sr->is_compressed, data, &sr->eof, &sr->line)))
+      return -1;
+    if (g_strrstr(&data->str[data->len >= 5 ? data->len - 5 : 0], ";\n")) {
+      if (sr->infile != NULL && sr->end > 0 && (guint64)ftello(sr->infile) >= sr->end)
+        sr->eof=TRUE;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+struct pipeline_statement {
+  GString *data;
+  guint preline;
+  guint line;
+  int status;
+};
+
+struct statement_pipeline {
+  GThread *thread;
+  GAsyncQueue *work;
+  GAsyncQueue *free;
+  GAsyncQueue *ready;
+  struct pipeline_statement *items;
+};
+
+static struct statement_reader pipeline_end;
+
+// Each loader thread keeps one reader thread, which reads the statements of
+// the file being restored ahead of the loader thread, which only needs to
+// execute them. The number of statements read ahead is bounded by the items
+// in the free queue.
+static void *statement_pipeline_thread(struct statement_pipeline *sp){
+  struct statement_reader *sr=NULL;
+  struct pipeline_statement *ps=NULL;
+  guint preline=0;
+  while ((sr=g_async_queue_pop(sp->work)) != &pipeline_end){
+    preline=0;
+    do {
+      ps=g_async_queue_pop(sp->free);
+      g_string_set_size(ps->data, 0);
+      ps->status=read_next_statement(sr, ps->data);
+      ps->preline=preline;
+      ps->line=sr->line;
+      preline=ps->line+1;
+      g_async_queue_push(sp->ready, ps);
+    } while (ps->status > 0);
+  }
+  return NULL;
+}
+
+static struct statement_pipeline *get_statement_pipeline(struct thread_data *td){
+  guint n=0;
+  if (td->pipeline != NULL)
+    return td->pipeline;
+  struct statement_pipeline *sp=g_new(struct statement_pipeline, 1);
+  sp->work=g_async_queue_new();
+  sp->free=g_async_queue_new();
+  sp->ready=g_async_queue_new();
+  sp->items=g_new(struct pipeline_statement, statement_pipeline_depth);
+  for (n = 0; n < statement_pipeline_depth; n++){
+    sp->items[n].data=g_string_sized_new(512);
+    g_async_queue_push(sp->free, &(sp->items[n]));
+  }
+  sp->thread=g_thread_create((GThreadFunc)statement_pipeline_thread, sp, TRUE, NULL);
+  td->pipeline=sp;
+  return sp;
+}
+
+void finish_statement_pipeline(struct thread_data *td){
+  guint n=0;
+  struct statement_pipeline *sp=td->pipeline;
+  if (sp == NULL)
+    return;
+  g_async_queue_push(sp->work, &pipeline_end);
+  g_thread_join(sp->thread);
+  for (n = 0; n < statement_pipeline_depth; n++)
+    g_string_free(sp->items[n].data, TRUE);
+  g_free(sp->items);
+  g_async_queue_unref(sp->work);
+  g_async_queue_unref(sp->free);
+  g_async_queue_unref(sp->ready);
+  g_free(sp);
+  td->pipeline=NULL;
+}
+
+static int restore_statement(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter,
+                             struct prepared_insert *pi, const char *filename, guint preline, guint line){
+  int tr=0;
+  if (pi != NULL && g_str_has_prefix(data->str,"INSERT")){
+    tr=load_data_local ? restore_insert_with_load_data(td, pi, data, query_counter) :
+                         restore_insert_with_prepared_statement(td, pi, data, query_counter);
+    if (tr >= 0){
+      if (tr > 0)
+        g_critical("Error occurs between lines: %d and %d on file %s",preline,line,filename);
+      return tr;
+    }
+  }
+  if ( skip_definer && g_str_has_prefix(data->str,"CREATE")){
+    char * from=g_strstr_len(data->str,30," DEFINER")+1;
+    if (from){
+      char * to=g_strstr_len(from,30," ");
+      if (to){
+        while(from != to){
+          from[0]=' ';
+          from++;
+        }
+        g_message("It is a create statement %s: %s",filename,from);
+      }
+    }
+  }
+  if (rows > 0 && g_strrstr_len(data->str,6,"INSERT"))
+    tr=split_and_restore_data_in_gstring_by_statement(td,
+      data, is_schema, query_counter,preline);
+  else
+    tr=restore_data_in_gstring_by_statement(td, data, is_schema, query_counter);
+  if (tr > 0){
+      g_critical("Error occurs between lines: %d and %d on file %s: %s",preline,line,filename,mysql_error(td->thrconn));
+  }
+  g_string_set_size(data, 0);
+  return tr;
+}
+
+// When length is not 0, only the statements between offset and offset +
+// length are restored. The range must start and finish on statement
+// boundaries, and it is only possible over uncompressed files.
+int restore_data_from_file_range(struct thread_data *td, char *database, char *table,
+                  const char *filename, gboolean is_schema, GString *prefetched,
+                  guint64 header_length, guint64 offset, guint64 length){
+  struct statement_reader sr = {NULL, FALSE, prefetched, 0, length > 0 ? offset + length : 0, FALSE, 0};
+  int r=0, status=0;
   guint query_counter = 0;
-  GString *data = g_string_sized_new(512);
-  guint line=0,preline=0;
+  guint preline=0;
+  struct prepared_insert *pi=NULL;
   gchar *path = g_build_filename(directory, filename, NULL);
-  ml_open(&infile,path,&is_compressed);
+  // When the prefetch threads already decompressed the file, we just need
+  // to iterate over the buffer
+  if (prefetched == NULL)
+    ml_open(&sr.infile,path,&sr.is_compressed);
+  if (sr.infile != NULL && length > 0 && (sr.is_compressed || fseeko(sr.infile, offset, SEEK_SET) != 0)){
+    g_critical("cannot seek to %llu on file %s (%d)", (unsigned long long)offset, filename, errno);
+    errors++;
+    if (!sr.is_compressed)
+      fclose(sr.infile);
+    else
+      gzclose((gzFile)sr.infile);
+    g_free(path);
+    return 1;
+  }
 
 /*  if (!g_str_has_suffix(path, compress_extension)) {
     infile = g_fopen(path, "r");
@@ -146,61 +402,63 @@ int restore_data_from_file(struct thread_data *td, char *database, char *table,
     is_compressed = TRUE;
   }*/
 
-  if (!infile) {
+  if (!sr.infile && prefetched == NULL) {
     g_critical("cannot open file %s (%d)", filename, errno);
     errors++;
+    g_free(path);
     return 1;
   }
+  if (offset > 0 && header_length > 0 && restore_data_file_header(td, path, filename, header_length)){
+    g_critical("Thread %d issue restoring header of %s: %s",td->thread_id,filename, mysql_error(td->thrconn));
+  }
   if (!is_schema && (commit_count > 1) )
     mysql_query(td->thrconn, "START TRANSACTION");
-  guint tr=0;
-  while (eof == FALSE) {
-    if (read_data(infile, is_compressed, data, &eof, &line)) {
-      if (g_strrstr(&data->str[data->len >= 5 ? data->len - 5 : 0], ";\n")) {
-        if ( skip_definer && g_str_has_prefix(data->str,"CREATE")){
-          char * from=g_strstr_len(data->str,30," DEFINER")+1;
-          if (from){
-            char * to=g_strstr_len(from,30," ");
-            if (to){
-              while(from != to){
-                from[0]=' ';
-                from++;
-              }
-              g_message("It is a create statement %s: %s",filename,from);
-            }
-          }
-        }
-        if (rows > 0 && g_strrstr_len(data->str,6,"INSERT"))
-          tr=split_and_restore_data_in_gstring_by_statement(td,
-            data, is_schema, &query_counter,preline);
-        else
-          tr=restore_data_in_gstring_by_statement(td, data, is_schema, &query_counter);
-        r+=tr;
-        if (tr > 0){
-            g_critical("Error occurs between lines: %d and %d on file %s: %s",preline,line,filename,mysql_error(td->thrconn));
-        }
-        g_string_set_size(data, 0);
-        preline=line+1;
-      }
-    } else {
-      g_critical("error reading file %s (%d)", filename, errno);
-      errors++;
-      return r;
+  td->transaction_bytes=0;
+  if (!is_schema && (prepared_insert || load_data_local))
+    pi=new_prepared_insert();
+  // A prefetched file is already in memory, there is nothing to read ahead
+  if (!is_schema && prefetched == NULL && statement_pipeline_depth > 0){
+    struct statement_pipeline *sp=get_statement_pipeline(td);
+    struct pipeline_statement *ps=NULL;
+    g_async_queue_push(sp->work, &sr);
+    while ((ps=g_async_queue_pop(sp->ready))->status > 0){
+      r+=restore_statement(td, ps->data, is_schema, &query_counter, pi, filename, ps->preline, ps->line);
+      g_async_queue_push(sp->free, ps);
     }
+    status=ps->status;
+    g_async_queue_push(sp->free, ps);
+  }else{
+    GString *data = g_string_sized_new(512);
+    while ((status=read_next_statement(&sr, data)) > 0){
+      r+=restore_statement(td, data, is_schema, &query_counter, pi, filename, preline, sr.line);
+      preline=sr.line+1;
+    }
+    g_string_free(data, TRUE);
   }
-  if (!is_schema && (commit_count > 1) && mysql_query(td->thrconn, "COMMIT")) {
+  if (pi != NULL)
+    free_prepared_insert(pi);
+  // The batch read so far is rolled back, otherwise the START TRANSACTION
+  // of the next file would commit it
+  if (status < 0){
+    g_critical("error reading file %s (%d)", filename, errno);
+    errors++;
+    if (!is_schema && (commit_count > 1))
+      mysql_query(td->thrconn, "ROLLBACK");
+  }else if (!is_schema && (commit_count > 1) && mysql_query(td->thrconn, "COMMIT")) {
     g_critical("Error committing data for %s.%s from file %s: %s",
                database, table, filename, mysql_error(td->thrconn));
     errors++;
   }
-  g_string_free(data, TRUE);
-  if (!is_compressed) {
-    fclose(infile);
-  } else {
-    gzclose((gzFile)infile);
+  if (sr.infile != NULL) {
+    if (!sr.is_compressed) {
+      fclose(sr.infile);
+    } else {
+      gzclose((gzFile)sr.infile);
+    }
   }
 
-  m_remove(directory,filename);
+  if (status >= 0)
+    m_remove(directory,filename);
   g_free(path);
   return r;
 }
@@ -14,8 +14,20 @@
 
         Authors:    David Ducos, Percona (david dot ducos at percona dot com)
 */
+#ifndef _src_myloader_restore_h
+#define _src_myloader_restore_h
+#include "myloader.h"
+#include "myloader_statement.h"
+
 void load_restore_entries(GOptionGroup *main_group);
 int restore_data_from_file(struct thread_data *td, char *database, char *table,
-                  const char *filename, gboolean is_schema);
+                  const char *filename, gboolean is_schema, GString *prefetched);
+int restore_data_from_file_range(struct thread_data *td, char *database, char *table,
+                  const char *filename, gboolean is_schema, GString *prefetched,
+                  guint64 header_length, guint64 offset, guint64 length);
+int count_query_and_commit(struct thread_data *td, gsize len, gboolean is_schema, guint *query_counter);
+int restore_data_in_buffer_by_statement(struct thread_data *td, const gchar *buffer, gsize len, gboolean is_schema, guint *query_counter);
 int restore_data_in_gstring_by_statement(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter);
 int restore_data_in_gstring(struct thread_data *td, GString *data, gboolean is_schema, guint *query_counter);
+void finish_statement_pipeline(struct thread_data *td);
+#endif
@@ -25,6 +25,9 @@
 #include <glib-unix.h>
 
 #include "myloader_common.h"
+#include "myloader_stream.h"
+#include "trace.h"
+#include "control.h"
 
 extern gboolean serial_tbl_creation;
 extern gboolean overwrite_tables;
@@ -41,10 +44,17 @@ unsigned long long int total_data_sql_files = 0;
 
 enum purge_mode purge_mode;
 
+static void append_restore_progress(GString *s){
+  g_mutex_lock(progress_mutex);
+  g_string_append_printf(s, "data_files: %llu of %llu\n", progress, total_data_sql_files);
+  g_mutex_unlock(progress_mutex);
+}
+
 void initialize_restore_job(gchar * purge_mode_str){
   file_list_to_do = g_async_queue_new();
   single_threaded_create_table = g_mutex_new();
   progress_mutex = g_mutex_new();
+  control_set_progress(append_restore_progress);
   if (purge_mode_str){
     if (!strcmp(purge_mode_str,"TRUNCATE")){
       purge_mode=TRUNCATE;
@@ -67,6 +77,10 @@ struct data_restore_job * new_data_restore_job_internal( guint index, guint part
   drj->index    = index;
   drj->part     = part;
   drj->sub_part = sub_part;
+  drj->header_length = 0;
+  drj->offset = 0;
+  drj->length = 0;
+  drj->prefetch = NULL;
   return drj;
 }
 
@@ -92,6 +106,15 @@ struct restore_job * new_data_restore_job( char * filename, enum restore_job_typ
   return rj;
 }
 
+struct restore_job * new_data_range_restore_job(struct restore_job *rj, guint64 header_length, guint64 offset, guint64 length){
+  struct restore_job *range = new_data_restore_job(rj->filename, rj->type, rj->dbt, rj->data.drj->part, rj->data.drj->sub_part);
+  range->data.drj->index         = rj->data.drj->index;
+  range->data.drj->header_length = header_length;
+  range->data.drj->offset        = offset;
+  range->data.drj->length        = length;
+  return range;
+}
+
 struct restore_job * new_schema_restore_job( char * filename, enum restore_job_type type, struct db_table * dbt, char * database, GString * statement, const char *object){
   struct restore_job *rj = new_restore_job(filename, dbt, type);
   rj->data.srj=new_schema_restore_job_internal(database, statement, object);
@@ -134,6 +157,22 @@ int overwrite_table(MYSQL *conn,gchar * database, gchar * table){
   return truncate_or_delete_failed;
 }
 
+void set_schema_created(struct db_table *dbt){
+  g_mutex_lock(dbt->mutex);
+  dbt->schema_state=CREATED;
+  g_cond_broadcast(dbt->schema_cond);
+  if (stream)
+    push_ready_table(dbt);
+  g_mutex_unlock(dbt->mutex);
+}
+
+void wait_schema_created(struct db_table *dbt){
+  g_mutex_lock(dbt->mutex);
+  while (dbt->schema_state == NOT_CREATED)
+    g_cond_wait(dbt->schema_cond, dbt->mutex);
+  g_mutex_unlock(dbt->mutex);
+}
+
 void process_restore_job(struct thread_data *td, struct restore_job *rj){
   if (td->conf->pause_resume){
     GMutex *resume_mutex = (GMutex *)g_async_queue_try_pop(td->conf->pause_resume);
@@ -145,16 +184,26 @@ void process_restore_job(struct thread_data *td, struct restore_job *rj){
   }
   if (shutdown_triggered){
 //    g_message("file enqueued to allow resume: %s", rj->filename);
-    g_async_queue_push(file_list_to_do,rj->filename);
+    // The other ranges of the file might be already committed, so only
+    // the pending range is written to the resume file
+    if (rj->type == JOB_RESTORE_FILENAME && rj->data.drj->length > 0)
+      g_async_queue_push(file_list_to_do, g_strdup_printf("%s\t%llu\t%llu\t%llu", rj->filename,
+                         (unsigned long long)rj->data.drj->header_length, (unsigned long long)rj->data.drj->offset,
+                         (unsigned long long)rj->data.drj->length));
+    else
+      g_async_queue_push(file_list_to_do,rj->filename);
+    prefetch_release(rj);
     goto cleanup;
   }
   struct db_table *dbt=rj->dbt;
+  guint64 ts=trace_begin(), restored_bytes=td->restored_bytes;
   switch (rj->type) {
     case JOB_RESTORE_STRING:
       g_message("Thread %d restoring %s `%s`.`%s` from %s", td->thread_id, rj->data.srj->object,
                 dbt->real_database, dbt->real_table, rj->filename);
       guint query_counter=0;
       restore_data_in_gstring(td, rj->data.srj->statement, FALSE, &query_counter);
+      trace_end(ts, rj->data.srj->object, "schema", dbt->real_database, dbt->real_table, td->restored_bytes - restored_bytes);
       break;
     case JOB_RESTORE_SCHEMA_STRING:
       if (serial_tbl_creation) g_mutex_lock(single_threaded_create_table);
@@ -171,35 +220,45 @@ void process_restore_job(struct thread_data *td, struct restore_job *rj){
           g_critical("Thread %d issue restoring %s: %s",td->thread_id,rj->filename, mysql_error(td->thrconn));
         }
       }
-      dbt->schema_created=TRUE;
       if (serial_tbl_creation) g_mutex_unlock(single_threaded_create_table);
+      set_schema_created(dbt);
+      trace_end(ts, "create table", "schema", dbt->real_database, dbt->real_table, td->restored_bytes - restored_bytes);
       break;
     case JOB_RESTORE_FILENAME:
       g_mutex_lock(progress_mutex);
       progress++;
-      g_message("Thread %d restoring `%s`.`%s` part %d of %d from %s. Progress %llu of %llu.", td->thread_id,
+      if (rj->data.drj->length > 0)
+        g_message("Thread %d restoring `%s`.`%s` part %d of %d from %s, bytes %llu to %llu. Progress %llu of %llu.", td->thread_id,
+                dbt->real_database, dbt->real_table, rj->data.drj->index, dbt->count, rj->filename,
+                (unsigned long long)rj->data.drj->offset, (unsigned long long)(rj->data.drj->offset + rj->data.drj->length), progress,total_data_sql_files);
+      else
+        g_message("Thread %d restoring `%s`.`%s` part %d of %d from %s. Progress %llu of %llu.", td->thread_id,
                 dbt->real_database, dbt->real_table, rj->data.drj->index, dbt->count, rj->filename, progress,total_data_sql_files);
       g_mutex_unlock(progress_mutex);
-      if (stream && !dbt->schema_created){
-        // In a stream scenario we might need to wait until table is created to start executing inserts.
-        int i=0;
-        while (!dbt->schema_created && i<100){
-          usleep(1000);
-          i++;
-        }
-        if (!dbt->schema_created){
-          g_critical("Table has not been created in more than 10 seconds");
-          exit(EXIT_FAILURE);
-        }
-      }
-      if (restore_data_from_file(td, dbt->real_database, dbt->real_table, rj->filename, FALSE) > 0){
+      // In stream mode, data jobs are dispatched once the table is created.
+      // Otherwise, the CREATE TABLE might still be executing in another thread
+      wait_schema_created(dbt);
+      // The slot is taken once the table exists, as the thread that creates
+      // it does not take one
+      control_job_begin();
+      td->dbt=dbt;
+      td->metrics_table=metrics_table(dbt->real_database, dbt->real_table);
+      if (restore_data_from_file_range(td, dbt->real_database, dbt->real_table, rj->filename, FALSE, prefetch_take(rj),
+                                       rj->data.drj->header_length, rj->data.drj->offset, rj->data.drj->length) > 0){
         g_critical("Thread %d issue restoring %s: %s",td->thread_id,rj->filename, mysql_error(td->thrconn));
       }
+      metrics_flush_table(td->metrics_table, &(td->metrics));
+      td->dbt=NULL;
+      td->metrics_table=NULL;
+      control_job_end();
+      trace_end(ts, "restore", "data", dbt->real_database, dbt->real_table, td->restored_bytes - restored_bytes);
+      prefetch_release(rj);
       break;
     case JOB_RESTORE_SCHEMA_FILENAME:
       g_message("Thread %d restoring %s on `%s` from %s", td->thread_id, rj->data.srj->object,
                 rj->data.srj->database, rj->filename);
-      restore_data_from_file(td, rj->data.srj->database, NULL, rj->filename, TRUE );
+      restore_data_from_file(td, rj->data.srj->database, NULL, rj->filename, TRUE, NULL);
+      trace_end(ts, rj->data.srj->object, "schema", rj->data.srj->database, NULL, td->restored_bytes - restored_bytes);
       break;
     default:
       g_critical("Something very bad happened!");
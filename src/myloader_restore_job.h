@@ -18,6 +18,7 @@
 #ifndef _src_myloader_restore_job_h
 #define _src_myloader_restore_job_h
 #include "myloader.h"
+#include "myloader_prefetch.h"
 
 enum restore_job_type { JOB_RESTORE_SCHEMA_FILENAME, JOB_RESTORE_FILENAME, JOB_RESTORE_SCHEMA_STRING, JOB_RESTORE_STRING };
 
@@ -27,6 +28,10 @@ struct data_restore_job{
   guint index;
   guint part;
   guint sub_part;
+  guint64 header_length;
+  guint64 offset;
+  guint64 length;
+  struct prefetch_buffer *prefetch;
 };
 
 struct schema_restore_job{
@@ -51,7 +56,10 @@ struct restore_job {
 void initialize_restore_job();
 //struct restore_job * new_restore_job( char * filename, /*char * database,*/ struct db_table * dbt, GString * statement, guint part, guint sub_part, enum restore_job_type type, const char *object);
 struct restore_job * new_data_restore_job( char * filename, enum restore_job_type type, struct db_table * dbt, guint part, guint sub_part);
+struct restore_job * new_data_range_restore_job(struct restore_job *rj, guint64 header_length, guint64 offset, guint64 length);
 struct restore_job * new_schema_restore_job( char * filename, enum restore_job_type type, struct db_table * dbt, char * database, GString * statement, const char *object);
 void process_restore_job(struct thread_data *td, struct restore_job *rj);
+void set_schema_created(struct db_table *dbt);
+void wait_schema_created(struct db_table *dbt);
 void restore_job_finish();
 #endif
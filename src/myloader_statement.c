@@ -0,0 +1,207 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef ZWRAP_USE_ZSTD
+#include "../zstd/zstd_zlibwrapper.h"
+#else
+#include <zlib.h>
+#endif
+#include "myloader_statement.h"
+
+gboolean read_data(FILE *file, gboolean is_compressed, GString *data,
+                   gboolean *eof, guint *line) {
+  char buffer[256];
+
+  do {
+    if (!is_compressed) {
+      if (fgets(buffer, 256, file) == NULL) {
+        if (feof(file)) {
+          *eof = TRUE;
+          buffer[0] = '\0';
+        } else {
+          return FALSE;
+        }
+      }
+    } else {
+      if (!gzgets((gzFile)file, buffer, 256)) {
+        if (gzeof((gzFile)file)) {
+          *eof = TRUE;
+          buffer[0] = '\0';
+        } else {
+          return FALSE;
+        }
+      }
+    }
+    g_string_append(data, buffer);
+    if (strlen(buffer) != 256)
+      (*line)++;
+  } while ((buffer[strlen(buffer)] != '\0') && *eof == FALSE);
+
+  return TRUE;
+}
+
+// Same as read_data, but over a file that has already been loaded in memory
+gboolean read_data_from_buffer(GString *buffer, gsize *offset, GString *data,
+                   gboolean *eof, guint *line) {
+  if (*offset >= buffer->len) {
+    *eof = TRUE;
+    return TRUE;
+  }
+  gchar *from = &(buffer->str[*offset]);
+  gchar *to = memchr(from, '\n', buffer->len - *offset);
+  gsize len = to != NULL ? (gsize)(to - from) + 1 : buffer->len - *offset;
+  g_string_append_len(data, from, len);
+  *offset += len;
+  (*line)++;
+  if (*offset >= buffer->len)
+    *eof = TRUE;
+  return TRUE;
+}
+
+void initialize_statement_iterator(struct statement_iterator *si, const gchar *buffer, gsize len){
+  si->buffer=buffer;
+  si->len=len;
+  si->offset=0;
+  g_strlcpy(si->delimiter, ";", sizeof(si->delimiter));
+  si->delimiter_len=1;
+}
+
+static gsize skip_to_end_of_line(const gchar *buffer, gsize len, gsize i){
+  const gchar *eol=memchr(&(buffer[i]), '\n', len - i);
+  return eol == NULL ? len : (gsize)(eol - buffer) + 1;
+}
+
+// Returns the next statement without its delimiter. A statement finishes
+// when the delimiter is found at the end of a line, outside quotes and
+// comments, which is how mydumper writes them: ";\n" inside the body of a
+// routine or trigger is written as "; \n". DELIMITER lines are consumed
+// and change the delimiter for the following statements.
+gboolean next_statement(struct statement_iterator *si, const gchar **statement, gsize *statement_len){
+  const gchar *b=si->buffer;
+  gsize len=si->len, i=si->offset, start=0;
+  gchar quote=0;
+  while (i < len){
+    // Skipping blanks between statements
+    while (i < len && g_ascii_isspace(b[i]))
+      i++;
+    if (i >= len)
+      break;
+    if (len - i > 10 && g_ascii_strncasecmp(&(b[i]), "DELIMITER ", 10) == 0){
+      gsize from=i+10, to=0;
+      while (from < len && (b[from] == ' ' || b[from] == '\t'))
+        from++;
+      to=from;
+      while (to < len && !g_ascii_isspace(b[to]))
+        to++;
+      if (to > from && to - from < sizeof(si->delimiter)){
+        memcpy(si->delimiter, &(b[from]), to - from);
+        si->delimiter[to - from]='\0';
+        si->delimiter_len=to - from;
+      }
+      i=skip_to_end_of_line(b, len, to);
+      continue;
+    }
+    start=i;
+    while (i < len){
+      if (quote){
+        if (b[i] == '\\' && quote != '`')
+          i++;
+        else if (b[i] == quote)
+          quote=0;
+        i++;
+      }else if (b[i] == '\'' || b[i] == '"' || b[i] == '`'){
+        quote=b[i];
+        i++;
+      }else if (b[i] == '/' && i + 1 < len && b[i+1] == '*' && (i + 2 >= len || b[i+2] != '!')){
+        const gchar *eoc=g_strstr_len(&(b[i+2]), len - i - 2, "*/");
+        i= eoc == NULL ? len : (gsize)(eoc - b) + 2;
+      }else if (b[i] == '#' || (b[i] == '-' && i + 2 < len && b[i+1] == '-' && g_ascii_isspace(b[i+2]))){
+        i=skip_to_end_of_line(b, len, i);
+      }else if (b[i] == si->delimiter[0] && len - i >= si->delimiter_len &&
+                memcmp(&(b[i]), si->delimiter, si->delimiter_len) == 0 &&
+                (i + si->delimiter_len == len || b[i + si->delimiter_len] == '\n' || b[i + si->delimiter_len] == '\r')){
+        *statement=&(b[start]);
+        *statement_len=i - start;
+        si->offset=i + si->delimiter_len;
+        return TRUE;
+      }else{
+        i++;
+      }
+    }
+    // Last statement might not have delimiter
+    *statement=&(b[start]);
+    *statement_len=len - start;
+    si->offset=len;
+    return TRUE;
+  }
+  si->offset=len;
+  return FALSE;
+}
+
+// Splits an extended INSERT in statements of at most rows rows each. The
+// rows of each statement are returned straight from data. As the rows of the
+// previous statement were already consumed, the prefix is copied in front of
+// the current rows, which means that data is modified.
+gboolean initialize_insert_splitter(struct insert_splitter *is, GString *data, guint offset_line){
+  gchar *values=g_strstr_len(data->str,data->len,"VALUES");
+  if (values == NULL)
+    return FALSE;
+  is->prefix_len=values + 6 - data->str;
+  is->prefix=g_strndup(data->str,is->prefix_len);
+  is->end=data->str + data->len;
+  while (is->end > values + 6 && (is->end[-1] == '\n' || is->end[-1] == ';'))
+    is->end--;
+  is->from=values + 6;
+  is->statement=data->str;
+  is->line=offset_line;
+  return TRUE;
+}
+
+gboolean next_insert_rows(struct insert_splitter *is, guint rows, const gchar **statement, gsize *statement_len,
+                          guint *first_line, guint *last_line){
+  guint current_rows=0, current_line=is->line-1;
+  gchar *to=is->from;
+  if (is->from >= is->end)
+    return FALSE;
+  do {
+    to=memchr(to, '\n', is->end - to);
+    to= to == NULL ? is->end : to + 1;
+    current_rows++;
+    current_line++;
+  } while (current_rows < rows && to < is->end);
+  *statement=is->statement;
+  *statement_len=to - is->statement;
+  *first_line=is->line;
+  *last_line=current_line;
+  is->line=current_line+1;
+  is->from=to;
+  while (is->from < is->end && (*is->from == ',' || *is->from == '\n'))
+    is->from++;
+  if (is->from < is->end){
+    is->statement=is->from - is->prefix_len;
+    memcpy(is->statement, is->prefix, is->prefix_len);
+  }
+  return TRUE;
+}
+
+void finish_insert_splitter(struct insert_splitter *is, GString *data){
+  g_free(is->prefix);
+  g_string_set_size(data, 0);
+}
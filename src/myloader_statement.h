@@ -0,0 +1,48 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_myloader_statement_h
+#define _src_myloader_statement_h
+#include <glib.h>
+#include <stdio.h>
+
+struct statement_iterator {
+  const gchar *buffer;
+  gsize len;
+  gsize offset;
+  gchar delimiter[16];
+  gsize delimiter_len;
+};
+
+struct insert_splitter {
+  gchar *prefix;
+  gsize prefix_len;
+  gchar *statement;
+  gchar *from;
+  gchar *end;
+  guint line;
+};
+
+gboolean read_data(FILE *file, gboolean is_compressed, GString *data, gboolean *eof, guint *line);
+gboolean read_data_from_buffer(GString *buffer, gsize *offset, GString *data, gboolean *eof, guint *line);
+void initialize_statement_iterator(struct statement_iterator *si, const gchar *buffer, gsize len);
+gboolean next_statement(struct statement_iterator *si, const gchar **statement, gsize *statement_len);
+gboolean initialize_insert_splitter(struct insert_splitter *is, GString *data, guint offset_line);
+gboolean next_insert_rows(struct insert_splitter *is, guint rows, const gchar **statement, gsize *statement_len,
+                          guint *first_line, guint *last_line);
+void finish_insert_splitter(struct insert_splitter *is, GString *data);
+#endif
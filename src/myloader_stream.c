@@ -40,14 +40,25 @@ extern gboolean no_data;
 extern gboolean skip_triggers;
 extern gboolean skip_post;
 extern guint num_threads;
-extern GAsyncQueue *stream_queue;
 extern int (*m_close)(void *file);
 extern int (*m_write)(FILE * file, const char * buff, int len);
 
 GAsyncQueue *intermidiate_queue = NULL;
+// Tables that have data jobs pending and less than max_threads threads
+// restoring them. It allows to get the next data job without iterating
+// over the table list.
+static GAsyncQueue *ready_table_queue = NULL;
 GThread *stream_thread = NULL;
 GThread *stream_intermidiate_thread = NULL;
 static GMutex *table_list_mutex = NULL;
+// Loader threads sleep on stream_cond until a database, table or data job is
+// enqueued. stream_generation changes on every wake up, which prevents to
+// miss a job enqueued while the thread was checking the queues.
+static GMutex *stream_mutex = NULL;
+static GCond *stream_cond = NULL;
+static guint stream_generation = 0;
+static gboolean stream_finished = FALSE;
+static gboolean all_files_processed = FALSE;
 
 struct configuration *stream_conf = NULL;
 
@@ -56,15 +67,18 @@ void *intermidiate_thread();
 
 void initialize_stream (struct configuration *c){
   stream_conf = c;
-  stream_queue = g_async_queue_new();
   intermidiate_queue = g_async_queue_new();
   table_list_mutex = g_mutex_new();
+  stream_mutex = g_mutex_new();
+  stream_cond = g_cond_new();
+  ready_table_queue = g_async_queue_new();
   stream_intermidiate_thread = g_thread_create((GThreadFunc)intermidiate_thread, NULL, TRUE, NULL);
   stream_thread = g_thread_create((GThreadFunc)process_stream, NULL, TRUE, NULL);
 }
 
 void wait_stream_to_finish(){
   g_thread_join(stream_thread);
+  g_thread_join(stream_intermidiate_thread);
 }
 
 enum file_type process_filename(char *filename){
@@ -124,6 +138,7 @@ enum file_type process_filename(char *filename){
         g_message("Load data file found: %s", filename);
         break;
       case SHUTDOWN:
+      case MANIFEST:
         break;
     }
   }
@@ -141,76 +156,73 @@ gboolean has_mydumper_suffix(gchar *line){
     g_str_has_suffix(line,"-checksum.zst");
 }
 
+void wake_up_stream_threads(gboolean all){
+  g_mutex_lock(stream_mutex);
+  stream_generation++;
+  if (all)
+    g_cond_broadcast(stream_cond);
+  else
+    g_cond_signal(stream_cond);
+  g_mutex_unlock(stream_mutex);
+}
+
 void process_stream_filename(gchar * filename){
   enum file_type current_ft=process_filename(filename);
-  if (current_ft != SCHEMA_VIEW &&
-      current_ft != SCHEMA_TRIGGER &&
-      current_ft != SCHEMA_POST &&
-      current_ft != CHECKSUM &&
-      current_ft != METADATA_TABLE )
-  g_async_queue_push(stream_queue, GINT_TO_POINTER(current_ft));
+  // Data files wake up the threads when the table is pushed to ready_table_queue
+  if (current_ft == INIT ||
+      current_ft == SCHEMA_CREATE ||
+      current_ft == SCHEMA_TABLE )
+    wake_up_stream_threads(FALSE);
 }
 
-struct control_job * give_any_data_job(){
-  g_mutex_lock(table_list_mutex);
-  GList * iter=stream_conf->table_list;
-  GList * next = NULL;
-  struct control_job *job = NULL;
-
-  while (iter != NULL){
-    struct db_table * dbt = iter->data;
-    g_mutex_lock(dbt->mutex);
-    if (g_list_length(dbt->restore_job_list) > 0){
-      job = dbt->restore_job_list->data;
-      next = dbt->restore_job_list->next;
-      g_list_free_1(dbt->restore_job_list);
-      dbt->restore_job_list = next;
-      g_mutex_unlock(dbt->mutex);
-      break;
-    }
-    g_mutex_unlock(dbt->mutex);
-    iter=iter->next;
+// dbt->mutex must be locked. Data jobs are not dispatched until the table is
+// created. Tables without schema file are dispatched when we know that it is
+// not going to be sent.
+void push_ready_table(struct db_table *dbt){
+  if (!dbt->in_ready_table_queue && dbt->restore_job_list != NULL && dbt->current_threads < dbt->max_threads &&
+      (dbt->schema_state == CREATED || (dbt->schema_state == NOT_FOUND && all_files_processed))){
+    dbt->in_ready_table_queue=TRUE;
+    g_async_queue_push(ready_table_queue, dbt);
+    wake_up_stream_threads(FALSE);
   }
-  g_mutex_unlock(table_list_mutex);
-
-  return job;
 }
 
 struct restore_job * give_me_next_data_job(){
-  g_mutex_lock(table_list_mutex);
-  GList * iter=stream_conf->table_list;
-  GList * next = NULL;
   struct restore_job *job = NULL;
-//  g_message("Elemetns in table_list: %d",g_list_length(stream_conf->table_list));
-  while (iter != NULL){
-    struct db_table * dbt = iter->data;
-//    g_message("DB: %s Table: %s len: %d", dbt->real_database,dbt->real_table,g_list_length(dbt->restore_job_list));
-    if (dbt->current_threads < dbt->max_threads){
-      // I could do some job in here, do we have some for me?
-      g_mutex_lock(dbt->mutex);
-      if (g_list_length(dbt->restore_job_list) > 0){
-        job = dbt->restore_job_list->data;
-        next = dbt->restore_job_list->next;
-        g_list_free_1(dbt->restore_job_list);
-        dbt->restore_job_list = next;
-        g_mutex_unlock(dbt->mutex);
-        break;
-      }
-      g_mutex_unlock(dbt->mutex);
-    }
-    iter=iter->next;
+  GList * next = NULL;
+  struct db_table * dbt = g_async_queue_try_pop(ready_table_queue);
+  if (dbt == NULL)
+    return NULL;
+  g_mutex_lock(dbt->mutex);
+  dbt->in_ready_table_queue=FALSE;
+  if (dbt->restore_job_list != NULL){
+    job = dbt->restore_job_list->data;
+    next = dbt->restore_job_list->next;
+    g_list_free_1(dbt->restore_job_list);
+    dbt->restore_job_list = next;
+    dbt->current_threads++;
   }
-  g_mutex_unlock(table_list_mutex);
+  // If there are more jobs and threads available, other threads can take them
+  push_ready_table(dbt);
+  g_mutex_unlock(dbt->mutex);
   return job;
 }
 
+void data_job_finished(struct db_table *dbt){
+  g_mutex_lock(dbt->mutex);
+  dbt->current_threads--;
+  push_ready_table(dbt);
+  g_mutex_unlock(dbt->mutex);
+}
+
 void *process_stream_queue(struct thread_data * td) {
   struct control_job *job = NULL;
   gboolean cont=TRUE;
-  enum file_type ft=0;
-//  enum file_type ft;
+  guint generation=0;
   while (cont){
-    ft=(enum file_type)g_async_queue_pop(stream_queue);
+    g_mutex_lock(stream_mutex);
+    generation=stream_generation;
+    g_mutex_unlock(stream_mutex);
     job=g_async_queue_try_pop(stream_conf->database_queue);
     if (job != NULL){
       g_debug("Restoring database");
@@ -225,23 +237,21 @@ void *process_stream_queue(struct thread_data * td) {
     }
     struct restore_job *rj = give_me_next_data_job();
     if (rj != NULL){
+      struct db_table *dbt=rj->dbt;
       job=new_job(JOB_RESTORE,rj,rj->dbt->database);
-      execute_use_if_needs_to(td, job->use_database, "Restoring tables (1)");
+      execute_use_if_needs_to(td, job->use_database, "Restoring tables");
       cont=process_job(td, job);
+      data_job_finished(dbt);
       continue;
     }
-    job=give_any_data_job();
-    if (job != NULL){
-      execute_use_if_needs_to(td, job->use_database, "Restoring tables (2)");
-      cont=process_job(td, job);
-      continue;
-    }else{
-      if (ft==SHUTDOWN)
-        cont=FALSE;
-      else
-        g_async_queue_push(stream_queue,GINT_TO_POINTER(ft));
-    }
-    
+    // Nothing to do, we wait until something is enqueued. Data jobs of the
+    // tables that already have max_threads threads are left to them.
+    g_mutex_lock(stream_mutex);
+    while (generation == stream_generation && !stream_finished)
+      g_cond_wait(stream_cond, stream_mutex);
+    if (generation == stream_generation && stream_finished)
+      cont=FALSE;
+    g_mutex_unlock(stream_mutex);
   }
   g_message("Shutting down stream thread");
   return NULL;
@@ -254,6 +264,28 @@ void *intermidiate_thread(){
     if ( g_strcmp0(filename,"END") == 0 ) break;
     process_stream_filename(filename);
   } while (filename != NULL);
+  // All the files have been processed, so no more jobs are going to be
+  // enqueued and the threads can move to the post tasks
+  guint n=0;
+  for (n = 0; n < num_threads *2 ; n++) {
+    g_async_queue_push(stream_conf->data_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
+    g_async_queue_push(stream_conf->post_table_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
+    g_async_queue_push(stream_conf->post_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
+  }
+  GHashTableIter iter;
+  gchar * lkey;
+  struct db_table *dbt=NULL;
+  all_files_processed=TRUE;
+  g_hash_table_iter_init ( &iter, stream_conf->table_hash );
+  while ( g_hash_table_iter_next ( &iter, (gpointer *) &lkey, (gpointer *) &dbt ) ) {
+    g_mutex_lock(dbt->mutex);
+    push_ready_table(dbt);
+    g_mutex_unlock(dbt->mutex);
+  }
+  g_mutex_lock(stream_mutex);
+  stream_finished=TRUE;
+  g_cond_broadcast(stream_cond);
+  g_mutex_unlock(stream_mutex);
   return NULL;
 }
 
@@ -344,13 +376,6 @@ void *process_stream(){
     g_async_queue_push(intermidiate_queue, filename);
   gchar *e=g_strdup("END");
   g_async_queue_push(intermidiate_queue, e);
-  guint n=0;
-  for (n = 0; n < num_threads *2 ; n++) {
-    g_async_queue_push(stream_conf->data_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
-    g_async_queue_push(stream_conf->post_table_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
-    g_async_queue_push(stream_conf->post_queue, new_job(JOB_SHUTDOWN,NULL,NULL));
-    g_async_queue_push(stream_queue, GINT_TO_POINTER(SHUTDOWN));
-  }
 
   return NULL;
 }
@@ -18,3 +18,4 @@
 void *process_stream_queue(struct thread_data * td);
 void initialize_stream (struct configuration *conf);
 void wait_stream_to_finish();
+void push_ready_table(struct db_table *dbt);
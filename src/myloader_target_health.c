@@ -0,0 +1,216 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+#include <mysql.h>
+#include <glib.h>
+#include <string.h>
+#include "connection.h"
+#include "common.h"
+#include "control.h"
+#include "myloader_target_health.h"
+
+extern guint num_threads;
+
+guint health_check_interval = 0;
+guint max_replica_lag = 0;
+guint max_row_lock_waits = 0;
+guint max_checkpoint_age = 0;
+guint max_statement_latency = 0;
+gchar *replicas = NULL;
+
+static GAsyncQueue *health_stop = NULL;
+static GThread *health_thread = NULL;
+static GMutex *latency_mutex = NULL;
+static guint64 latency_ns = 0;
+static guint64 latency_count = 0;
+static volatile guint batch_percent = 100;
+
+static GOptionEntry target_health_entries[] = {
+    {"health-check-interval", 0, 0, G_OPTION_ARG_INT, &health_check_interval,
+     "Seconds between two checks of the load of the target, which reduce the threads and the batch sizes when a limit is exceeded and increase them back when the target recovers. 0 disables it, default 0", NULL},
+    {"replicas", 0, 0, G_OPTION_ARG_STRING, &replicas,
+     "Comma separated list of host[:port] of the replicas of the target, used to check --max-replica-lag", NULL},
+    {"max-replica-lag", 0, 0, G_OPTION_ARG_INT, &max_replica_lag,
+     "Seconds_Behind_Master of any of the --replicas above which the load slows down. 0 means no limit, default 0", NULL},
+    {"max-row-lock-waits", 0, 0, G_OPTION_ARG_INT, &max_row_lock_waits,
+     "Innodb_row_lock_waits per second of the target above which the load slows down. 0 means no limit, default 0", NULL},
+    {"max-checkpoint-age", 0, 0, G_OPTION_ARG_INT, &max_checkpoint_age,
+     "InnoDB checkpoint age in MB of the target above which the load slows down. 0 means no limit, default 0", NULL},
+    {"max-statement-latency", 0, 0, G_OPTION_ARG_INT, &max_statement_latency,
+     "Average time in milliseconds of the data statements above which the load slows down. 0 means no limit, default 0", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_target_health_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, target_health_entries);
+}
+
+void record_statement_latency(guint64 ns){
+  if (health_thread == NULL)
+    return;
+  g_mutex_lock(latency_mutex);
+  latency_ns+=ns;
+  latency_count++;
+  g_mutex_unlock(latency_mutex);
+}
+
+// Average of the statements executed since the last call, -1 if none
+static gint64 take_statement_latency(){
+  gint64 ms=-1;
+  g_mutex_lock(latency_mutex);
+  if (latency_count > 0)
+    ms=latency_ns / latency_count / 1000000;
+  latency_ns=0;
+  latency_count=0;
+  g_mutex_unlock(latency_mutex);
+  return ms;
+}
+
+// Rows per INSERT and statements per transaction are scaled together with
+// the threads
+guint adapt_batch_size(guint size){
+  if (batch_percent >= 100)
+    return size;
+  return MAX(size * batch_percent / 100, 1);
+}
+
+static gint64 get_innodb_status_number(const gchar *status, const gchar *name){
+  const gchar *p=g_strstr_len(status, -1, name);
+  if (p == NULL)
+    return -1;
+  return g_ascii_strtoll(p + strlen(name), NULL, 10);
+}
+
+// Log sequence number minus Last checkpoint at, in MB
+static gint64 get_checkpoint_age(MYSQL *conn){
+  MYSQL_RES *res=NULL;
+  MYSQL_ROW row;
+  gint64 lsn=-1, checkpoint=-1;
+  if (mysql_query(conn, "SHOW ENGINE INNODB STATUS") || !(res = mysql_store_result(conn)))
+    return -1;
+  if ((row = mysql_fetch_row(res)) && mysql_num_fields(res) > 2 && row[2] != NULL){
+    lsn=get_innodb_status_number(row[2], "Log sequence number");
+    checkpoint=get_innodb_status_number(row[2], "Last checkpoint at");
+  }
+  mysql_free_result(res);
+  if (lsn < 0 || checkpoint < 0)
+    return -1;
+  return (lsn - checkpoint) / (1024 * 1024);
+}
+
+static GList *connect_replicas(){
+  GList *list=NULL;
+  gchar **hosts=g_strsplit(replicas, ",", 0);
+  guint i;
+  for (i = 0; hosts[i] != NULL; i++){
+    gchar **host_port=g_strsplit(g_strstrip(hosts[i]), ":", 2);
+    MYSQL *conn=mysql_init(NULL);
+    if (host_port[0] != NULL && m_connect_to_host(conn, "myloader", host_port[0],
+          host_port[1] != NULL ? (guint)g_ascii_strtoull(host_port[1], NULL, 10) : 3306))
+      list=g_list_append(list, conn);
+    else
+      mysql_close(conn);
+    g_strfreev(host_port);
+  }
+  g_strfreev(hosts);
+  return list;
+}
+
+// Values that are not known do not count
+static gboolean is_over(gint64 value, guint limit){
+  return limit > 0 && value >= 0 && value > limit;
+}
+
+static gboolean is_relaxed(gint64 value, guint limit){
+  return limit == 0 || value < 0 || value * 10 <= (gint64)limit * 8;
+}
+
+// Halves the threads and the batch sizes when any limit is exceeded. While
+// all the values stay under 80% of their limits the batch sizes are restored
+// first, by 10% per check, and then the threads, one per check.
+static void *target_health_thread(void *data){
+  (void) data;
+  MYSQL *conn=mysql_init(NULL);
+  GList *replica_conns=NULL, *l=NULL;
+  guint threads=num_threads, next=0, percent=100, next_percent=0;
+  gint64 lag=-1, lock_waits=-1, last_lock_waits=-1, checkpoint_age=-1, latency=-1, value=-1;
+  GTimeVal tv;
+  m_connect(conn, "myloader", NULL);
+  if (replicas != NULL && max_replica_lag > 0)
+    replica_conns=connect_replicas();
+  while (1){
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, (glong)health_check_interval * G_USEC_PER_SEC);
+    if (g_async_queue_timed_pop(health_stop, &tv) != NULL)
+      break;
+    lag=-1;
+    for (l = replica_conns; l != NULL; l = l->next)
+      lag=MAX(lag, get_replica_lag((MYSQL *)l->data));
+    if (max_row_lock_waits > 0){
+      value=get_server_value(conn, "SHOW GLOBAL STATUS LIKE 'Innodb_row_lock_waits'", 1);
+      lock_waits=value >= 0 && last_lock_waits >= 0 ? (value - last_lock_waits) / health_check_interval : -1;
+      last_lock_waits=value;
+    }
+    if (max_checkpoint_age > 0)
+      checkpoint_age=get_checkpoint_age(conn);
+    latency=take_statement_latency();
+    next=threads;
+    next_percent=percent;
+    if (is_over(lag, max_replica_lag) || is_over(lock_waits, max_row_lock_waits) ||
+        is_over(checkpoint_age, max_checkpoint_age) || is_over(latency, max_statement_latency)){
+      next=MAX(threads / 2, 1);
+      next_percent=MAX(percent / 2, 10);
+    }else if (is_relaxed(lag, max_replica_lag) && is_relaxed(lock_waits, max_row_lock_waits) &&
+              is_relaxed(checkpoint_age, max_checkpoint_age) && is_relaxed(latency, max_statement_latency)){
+      if (percent < 100)
+        next_percent=MIN(percent + 10, 100);
+      else
+        next=MIN(threads + 1, num_threads);
+    }
+    if (next != threads || next_percent != percent){
+      g_message("Replica lag: %lld, row lock waits/s: %lld, checkpoint age: %lld MB, statement latency: %lld ms. Loading with %u threads and %u%% batch sizes",
+                (long long)lag, (long long)lock_waits, (long long)checkpoint_age, (long long)latency, next, next_percent);
+      threads=next;
+      percent=next_percent;
+      batch_percent=percent;
+      control_set_adaptive_threads(threads);
+    }
+  }
+  for (l = replica_conns; l != NULL; l = l->next)
+    mysql_close((MYSQL *)l->data);
+  g_list_free(replica_conns);
+  mysql_close(conn);
+  mysql_thread_end();
+  return NULL;
+}
+
+void start_target_health(){
+  if (health_check_interval == 0)
+    return;
+  latency_mutex=g_mutex_new();
+  health_stop=g_async_queue_new();
+  health_thread=g_thread_create((GThreadFunc)target_health_thread, NULL, TRUE, NULL);
+}
+
+void stop_target_health(){
+  if (health_thread == NULL)
+    return;
+  g_async_queue_push(health_stop, GINT_TO_POINTER(1));
+  g_thread_join(health_thread);
+  g_async_queue_unref(health_stop);
+  health_thread=NULL;
+  batch_percent=100;
+  control_set_adaptive_threads(num_threads);
+}
@@ -0,0 +1,218 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <mysql.h>
+#include "common.h"
+#include "metrics.h"
+#include "trace.h"
+
+extern guint errors;
+
+gboolean trace_enabled = FALSE;
+gchar *trace_file = NULL;
+guint trace_buffer_events = 4096;
+
+struct trace_event {
+  guint64 start;
+  guint64 duration;
+  const gchar *name;
+  const gchar *category;
+  gchar *database;
+  gchar *table;
+  guint64 bytes;
+};
+
+// Each thread records its spans in its own buffer without locking. When the
+// buffer is full it is appended to the trace file, which is the only time
+// the lock is taken.
+struct trace_buffer {
+  guint thread_id;
+  guint count;
+  struct trace_event *events;
+};
+
+static GMutex *trace_mutex = NULL;
+static GPrivate *trace_thread_buffer = NULL;
+static GList *trace_buffers = NULL;
+static FILE *trace_output = NULL;
+static gboolean trace_first_event = TRUE;
+static guint64 trace_start = 0;
+
+static GOptionEntry trace_entries[] = {
+    {"trace-file", 0, 0, G_OPTION_ARG_FILENAME, &trace_file,
+     "Write a span for every job to this file in the Chrome trace event format", NULL},
+    {"trace-buffer-events", 0, 0, G_OPTION_ARG_INT, &trace_buffer_events,
+     "Number of spans that each thread buffers before writing them to the trace file. Default 4096", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+void load_trace_entries(GOptionGroup *main_group){
+  g_option_group_add_entries(main_group, trace_entries);
+}
+
+// Must be called with trace_mutex locked
+static void write_trace_buffer(struct trace_buffer *tb){
+  GString *s=g_string_sized_new(tb->count * 160);
+  guint i;
+  for (i = 0; i < tb->count; i++){
+    struct trace_event *e=&(tb->events[i]);
+    g_string_append_printf(s, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                           trace_first_event ? "" : ",\n", e->name, e->category, tb->thread_id,
+                           (double)(e->start - trace_start) / 1000, (double)e->duration / 1000);
+    trace_first_event=FALSE;
+    if (e->database != NULL){
+      g_string_append(s, "\"database\":");
+      append_json_string(s, e->database);
+      g_string_append(s, ",");
+    }
+    if (e->table != NULL){
+      g_string_append(s, "\"table\":");
+      append_json_string(s, e->table);
+      g_string_append(s, ",");
+    }
+    g_string_append_printf(s, "\"bytes\":%llu}}", (unsigned long long)e->bytes);
+    g_free(e->database);
+    g_free(e->table);
+  }
+  if (fwrite(s->str, 1, s->len, trace_output) != s->len)
+    g_warning("Could not write the trace file %s (%d)", trace_file, errno);
+  g_string_free(s, TRUE);
+  tb->count=0;
+}
+
+// Called when a thread exits, so the buffers of the threads of a dump do not
+// pile up in daemon mode
+static void free_trace_buffer(gpointer data){
+  struct trace_buffer *tb=data;
+  g_mutex_lock(trace_mutex);
+  if (trace_output != NULL)
+    write_trace_buffer(tb);
+  trace_buffers=g_list_remove(trace_buffers, tb);
+  g_mutex_unlock(trace_mutex);
+  g_free(tb->events);
+  g_free(tb);
+}
+
+static struct trace_buffer *get_trace_buffer(){
+  struct trace_buffer *tb=g_private_get(trace_thread_buffer);
+  if (tb == NULL){
+    tb=g_new0(struct trace_buffer, 1);
+    tb->events=g_new(struct trace_event, trace_buffer_events);
+    g_private_set(trace_thread_buffer, tb);
+    g_mutex_lock(trace_mutex);
+    trace_buffers=g_list_prepend(trace_buffers, tb);
+    g_mutex_unlock(trace_mutex);
+  }
+  return tb;
+}
+
+void trace_set_thread(guint thread_id){
+  if (!trace_enabled)
+    return;
+  get_trace_buffer()->thread_id=thread_id;
+  g_mutex_lock(trace_mutex);
+  fprintf(trace_output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+          trace_first_event ? "" : ",\n", thread_id, thread_id);
+  trace_first_event=FALSE;
+  g_mutex_unlock(trace_mutex);
+}
+
+guint64 trace_begin(){
+  return trace_enabled ? metrics_now() : 0;
+}
+
+// The name and the category must be literals, the database and the table
+// are copied as the jobs free them
+void trace_end(guint64 start, const gchar *name, const gchar *category, const gchar *database, const gchar *table, guint64 bytes){
+  if (!trace_enabled)
+    return;
+  struct trace_buffer *tb=get_trace_buffer();
+  struct trace_event *e=&(tb->events[tb->count]);
+  e->start=start;
+  e->duration=metrics_now() - start;
+  e->name=name;
+  e->category=category;
+  e->database=g_strdup(database);
+  e->table=g_strdup(table);
+  e->bytes=bytes;
+  tb->count++;
+  if (tb->count == trace_buffer_events){
+    g_mutex_lock(trace_mutex);
+    write_trace_buffer(tb);
+    g_mutex_unlock(trace_mutex);
+  }
+}
+
+void initialize_trace(){
+  if (trace_file == NULL)
+    return;
+  trace_output=g_fopen(trace_file, "w");
+  if (trace_output == NULL){
+    g_critical("Could not open the trace file %s (%d)", trace_file, errno);
+    errors++;
+    return;
+  }
+  if (trace_buffer_events == 0)
+    trace_buffer_events=1;
+  trace_mutex=g_mutex_new();
+  trace_thread_buffer=g_private_new(free_trace_buffer);
+  trace_start=metrics_now();
+  // Spans of the threads that do not call trace_set_thread go to thread 0
+  fprintf(trace_output, "{\"traceEvents\":[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Main\"}}");
+  trace_first_event=FALSE;
+  trace_enabled=TRUE;
+}
+
+// Writes the pending spans and closes the list of events. Must be called
+// with trace_mutex locked once the threads that record spans have finished
+static void write_trace_end(){
+  GList *e=NULL;
+  for (e = trace_buffers; e != NULL; e = e->next)
+    write_trace_buffer(e->data);
+  fprintf(trace_output, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+// In daemon mode the process never reaches finish_trace, so the list of
+// events is closed after every dump to leave a valid file. The spans of the
+// next dump overwrite the end of the list, which is then written again.
+void checkpoint_trace(){
+  if (!trace_enabled)
+    return;
+  g_mutex_lock(trace_mutex);
+  long position=ftell(trace_output);
+  write_trace_end();
+  if (fflush(trace_output))
+    g_warning("Could not write the trace file %s (%d)", trace_file, errno);
+  if (position >= 0)
+    fseek(trace_output, position, SEEK_SET);
+  g_mutex_unlock(trace_mutex);
+}
+
+void finish_trace(){
+  if (!trace_enabled)
+    return;
+  g_mutex_lock(trace_mutex);
+  write_trace_end();
+  fclose(trace_output);
+  trace_output=NULL;
+  trace_enabled=FALSE;
+  g_mutex_unlock(trace_mutex);
+}
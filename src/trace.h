@@ -0,0 +1,30 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+        Authors:    David Ducos, Percona (david dot ducos at percona dot com)
+*/
+
+#ifndef _src_trace_h
+#define _src_trace_h
+
+extern gboolean trace_enabled;
+
+void load_trace_entries(GOptionGroup *main_group);
+void initialize_trace();
+void trace_set_thread(guint thread_id);
+guint64 trace_begin();
+void trace_end(guint64 start, const gchar *name, const gchar *category, const gchar *database, const gchar *table, guint64 bytes);
+void checkpoint_trace();
+void finish_trace();
+#endif